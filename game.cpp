@@ -1,11 +1,24 @@
 #include "32blit.hpp"
 #include "src/apu.hpp"
+#include "src/cart_index.hpp"
 #include "src/gpu.hpp"
+#include <algorithm>
 #include <cstring>
 #include <iostream>
 
+#if !defined(TARGET_32BLIT_HW) && !defined(PICO_BUILD) && !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 extern "C" {
+#include "src/replay.h"
 #include "src/runtime.h"
+#include "src/savestate.h"
+#include "src/profile.h"
+#include "src/synth.h"
 #include "src/wasm.h"
 }
 
@@ -14,20 +27,130 @@ extern "C" {
 enum class EmulatorState { CART_LOADING, CART_LOADED, CART_SELECTION };
 
 static w4_Disk disk_storage_data{0, {}};
-static bool first_time = true;
-static uint32_t prev_time_ms = 0;
 static int mouse_x = 0;
 static int mouse_y = 0;
+// Screen area and framebuffer row of the cursor drawn last frame
+static blit::Rect cursor_rect{0, 0, 0, 0};
+static int cursor_row = 0;
+// Set whenever the screen shows something other than the cart
+static bool full_redraw = true;
 static EmulatorState emulator_state = EmulatorState::CART_SELECTION;
 static blit::File cart_file{};
-static std::vector<std::string> cart_files;
+
+enum class CartStorage { NONE, IN_PLACE, MAPPED, MALLOC };
+// The running cart's bytes, wasm3 parses them in place and keeps pointers
+// into them for as long as the module is loaded
+struct CartBuffer {
+  const uint8_t *bytes = nullptr;
+  size_t length = 0;
+  CartStorage storage = CartStorage::NONE;
+};
+static CartBuffer cart_buffer{};
+
+// The emulated console, recreated for every cart
+static w4_Runtime *runtime = nullptr;
+
+// Rewind: a state is captured every few frames into a ring of deltas. The
+// ring needs two uncompressed states of scratch on top of its size, which
+// the PicoSystem can't spare.
+#if defined(PICO_BUILD)
+static const int rewind_buffer_size = 0;
+#elif defined(TARGET_32BLIT_HW)
+static const int rewind_buffer_size = 48 * 1024;
+#else
+static const int rewind_buffer_size = 1024 * 1024;
+#endif
+static const int rewind_capture_interval = 4;
+static int frames_since_capture = 0;
+// Input recording, started once the cart finished compiling. Recordings go
+// next to the cart as <cart>.w4rp and are written out every few seconds, as
+// there is no exit hook to save them on.
+enum class ReplayRequest { NONE, RECORD, PLAY };
+static ReplayRequest replay_request = ReplayRequest::NONE;
+static std::string replay_path;
+static std::vector<uint8_t> replay_bytes;
+static const int replay_hash_interval = 60;
+static const int replay_save_interval = 600;
+static const std::string replay_extension = ".w4rp";
+// Cart logic runs at a fixed 60 Hz whatever rate update() gets called at.
+// Frames are due every 1000/60 ms from pacing_start_ms, which moves forward a
+// second at a time so the multiplication can't overflow.
+static const uint32_t logical_fps = 60;
+// More frames than this behind and the time is dropped instead, the cart
+// slows down rather than racing to catch up
+static const uint32_t max_catch_up = 4;
+static uint32_t pacing_start_ms = 0;
+static uint32_t pacing_frames = 0;
+// Set when a logical frame ran since the last composite, cleared when the
+// cart falls behind so the composite is skipped. Never more than max_catch_up
+// frames in a row go undrawn.
+static bool draw_pending = false;
+static uint32_t frames_undrawn = 0;
+// Logical frames run and frames composited, counted over a second
+static uint32_t rate_window_start_ms = 0;
+static int logical_count = 0;
+static int visual_count = 0;
+static int logical_rate = 0;
+static int visual_rate = 0;
+// Joystick button and right toggles turbo, joystick button and down picks the
+// next multiplier. Every due frame then runs turbo_multiplier cart updates,
+// only the last one is drawn and heard.
+static const int turbo_multipliers[] = {2, 4, 8, 16};
+static const int turbo_multiplier_count = 4;
+static bool turbo = false;
+static int turbo_multiplier_idx = 1;
+// Microseconds spent in cart updates and composites over the rate window,
+// the most updates a 60 Hz frame has time for follows from them
+static uint32_t update_us = 0;
+static uint32_t draw_us = 0;
+static int max_speed_tenths = 0;
+// Joystick button and up cycles through profiling off, the overlay in the
+// right side band, and the overlay plus a CSV row per drawn frame
+enum class ProfileMode { OFF, OVERLAY, CSV };
+static ProfileMode profile_mode = ProfileMode::OFF;
+static blit::File profile_csv{};
+static uint32_t profile_csv_offset = 0;
+static const std::string profile_csv_path = "profile.csv";
+// Cart saves live next to the cart as <cart>.disk. Carts may call diskw every
+// frame, so the file is written once the disk stayed the same for a second,
+// at least every ten seconds while it keeps changing, and before another cart
+// is loaded. persisted_disk is what the file holds.
+static const std::string disk_extension = ".disk";
+static std::string disk_path;
+static w4_Disk persisted_disk{0, {}};
+static int disk_writes_seen = 0;
+static bool disk_pending = false;
+static int disk_quiet_frames = 0;
+static int disk_pending_frames = 0;
+static const int disk_flush_quiet_frames = 60;
+static const int disk_flush_max_frames = 600;
+// Carts embedded in flash, when there are none the SD card root is listed
+static std::vector<CartFile> cart_files;
 static int cart_file_idx = 0;
 static int cart_file_render_start = 0;
 static const int cart_file_render_max = 10;
 static const std::string wasm_extension = ".wasm";
+// Functions are compiled ahead of time while the loading screen is up, a
+// slice per frame so the progress can be drawn
+static const uint32_t compile_slice_ms = 20;
+static int compile_done = 0;
+static int compile_total = 0;
 
 void load_cart(const std::string &cart_file_path);
+void start_replay();
+void load_disk(const std::string &cart_file_path);
+void update_disk();
+void flush_disk();
+void reset_pacing();
+void cycle_profile_mode();
+void end_profile_frame();
+void render_profile();
+void render_replay_status();
+void save_recording();
+std::string cart_memory_text();
+void update_loading();
 void initialize_wasm4();
+void check_wasm();
 void render_selector();
 void update_selector();
 void clamp_cart_idx();
@@ -95,7 +218,7 @@ void initialize_filesystem() {
 
     std::string file_path = "/" + std::string(dataPtr, filenameLength);
     if (endswith(file_path, wasm_extension)) {
-      cart_files.push_back(file_path);
+      cart_files.push_back(CartFile{file_path, fileLength});
     }
     blit::File::add_buffer_file(
         file_path, reinterpret_cast<uint8_t *>(dataPtr + filenameLength),
@@ -109,81 +232,351 @@ void init() {
   initialize_filesystem();
   init_apu();
   initialize_wasm4();
-#if !defined(TARGET_32BLIT_HW) && !defined(PICO_BUILD)
-  cart_files.emplace_back("./cart.wasm");
-  for (int i = 1; i < 30; i++) {
-    cart_files.emplace_back("./cart.wasm" + std::to_string(i));
-  }
-#else
+  w4_savestateInit(rewind_buffer_size);
   if (cart_files.empty()) {
     auto files = blit::list_files("/");
     for (auto const &file : files) {
       if ((file.flags & blit::FileFlags::directory) == 0) {
         if (endswith(file.name, wasm_extension)) {
-          cart_files.push_back(file.name);
+          cart_files.push_back(CartFile{file.name, file.size});
         }
       }
     }
   }
-#endif
+  // Only carts that are new or changed since the last boot get read
+  cart_index_update(cart_files);
+  cart_files.clear();
+  cart_file_idx = cart_index_last_played();
 }
 
 void initialize_wasm4() {
-  uint8_t *memory = w4_wasmInit();
-  w4_runtimeInit(memory, &disk_storage_data);
+  runtime = w4_runtimeCreate(&disk_storage_data);
+  if (runtime == nullptr) {
+    std::cerr << "Out of memory for the WASM-4 runtime" << std::endl;
+    exit(1);
+  }
 }
 
-void load_cart(const std::string &cart_file_path) {
-  char *cart_bytes;
-  size_t cart_length = 0;
+// A cart that trapped or failed to load can't go on
+void check_wasm() {
+  if (const char *error = w4_wasmError(w4_runtimeWasm(runtime))) {
+    std::cerr << error << std::endl;
+    exit(1);
+  }
+}
+
+// Maps or reads a cart into cart_buffer. Carts in flash (buffer files) and
+// on desktop are used in place, only other files get copied to RAM.
+bool open_cart_buffer(const std::string &cart_file_path) {
 #if defined(TARGET_32BLIT_HW) || defined(PICO_BUILD)
-  if (cart_file.open(cart_file_path)) {
-    cart_length = cart_file.get_length();
-    if (cart_length != 0) {
-      cart_bytes = static_cast<char *>(malloc(cart_length));
-      if (cart_bytes != nullptr) {
-        if (cart_file.read(0, cart_length,
-                           reinterpret_cast<char *>(cart_bytes)) != -1) {
-          // successfully loaded the bytes
-          emulator_state = EmulatorState::CART_LOADING;
-          w4_wasmLoadModule(reinterpret_cast<const uint8_t *>(cart_bytes),
-                            cart_length);
-          emulator_state = EmulatorState::CART_LOADED;
-        } else {
-          // clean cart_bytes as we failed to read to this buffer
-          free(cart_bytes);
-        }
-      }
-    }
+  if (!cart_file.open(cart_file_path)) {
+    return false;
   }
+  size_t length = cart_file.get_length();
+  if (length == 0) {
+    return false;
+  }
+  const uint8_t *flash = cart_file.get_ptr();
+  if (flash != nullptr) {
+    cart_buffer = CartBuffer{flash, length, CartStorage::IN_PLACE};
+    return true;
+  }
+  auto bytes = static_cast<uint8_t *>(malloc(length));
+  if (bytes == nullptr) {
+    return false;
+  }
+  if (cart_file.read(0, length, reinterpret_cast<char *>(bytes)) == -1) {
+    free(bytes);
+    return false;
+  }
+  cart_buffer = CartBuffer{bytes, length, CartStorage::MALLOC};
+  return true;
+#elif !defined(_WIN32)
+  int fd = open(cart_file_path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat info {};
+  void *mapped = MAP_FAILED;
+  if (fstat(fd, &info) == 0 && info.st_size > 0) {
+    mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  // The mapping stays valid after the descriptor is closed
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    return false;
+  }
+  cart_buffer = CartBuffer{static_cast<const uint8_t *>(mapped),
+                           static_cast<size_t>(info.st_size),
+                           CartStorage::MAPPED};
+  return true;
 #else
   FILE *file = fopen(cart_file_path.c_str(), "rb");
-  if (file != nullptr) {
-    fseek(file, 0, SEEK_END);
-    cart_length = ftell(file);
-    fseek(file, 0, SEEK_SET);
-    cart_bytes = static_cast<char *>(malloc(cart_length));
-    if (cart_bytes != nullptr) {
-      cart_length = fread(cart_bytes, 1, cart_length, file);
-    } else {
-      cart_length = 0;
+  if (file == nullptr) {
+    return false;
+  }
+  fseek(file, 0, SEEK_END);
+  size_t length = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  auto bytes = length != 0 ? static_cast<uint8_t *>(malloc(length)) : nullptr;
+  if (bytes != nullptr && fread(bytes, 1, length, file) != length) {
+    free(bytes);
+    bytes = nullptr;
+  }
+  fclose(file);
+  if (bytes == nullptr) {
+    return false;
+  }
+  cart_buffer = CartBuffer{bytes, length, CartStorage::MALLOC};
+  return true;
+#endif
+}
+
+void release_cart_buffer() {
+  if (cart_buffer.storage == CartStorage::MALLOC) {
+    free(const_cast<uint8_t *>(cart_buffer.bytes));
+#if !defined(TARGET_32BLIT_HW) && !defined(PICO_BUILD) && !defined(_WIN32)
+  } else if (cart_buffer.storage == CartStorage::MAPPED) {
+    munmap(const_cast<uint8_t *>(cart_buffer.bytes), cart_buffer.length);
+#endif
+  }
+  cart_buffer = CartBuffer{};
+}
+
+void load_cart(const std::string &cart_file_path) {
+  if (cart_buffer.bytes != nullptr) {
+    // wasm3 keeps pointers into the old cart, start over with a fresh VM
+    // before letting go of it
+    w4_runtimeDestroy(runtime);
+    initialize_wasm4();
+    release_cart_buffer();
+  }
+  flush_disk();
+  w4_savestateReset();
+  w4_replayStop();
+  replay_path = cart_file_path + replay_extension;
+  if (!open_cart_buffer(cart_file_path)) {
+    return;
+  }
+  // Loading runs the cart's initializers, which may read the disk already
+  load_disk(cart_file_path);
+  emulator_state = EmulatorState::CART_LOADING;
+  w4_wasmLoadModule(w4_runtimeWasm(runtime), cart_buffer.bytes,
+                    cart_buffer.length);
+  check_wasm();
+}
+
+void load_disk(const std::string &cart_file_path) {
+  disk_path = cart_file_path + disk_extension;
+  disk_storage_data.size = 0;
+  blit::File file;
+  if (file.open(disk_path)) {
+    uint32_t length = std::min<uint32_t>(file.get_length(),
+                                         sizeof(disk_storage_data.data));
+    int32_t read = file.read(0, length,
+                             reinterpret_cast<char *>(disk_storage_data.data));
+    disk_storage_data.size = read > 0 ? read : 0;
+  }
+  persisted_disk = disk_storage_data;
+  disk_writes_seen = w4_runtimeDiskWrites(runtime);
+  disk_pending = false;
+}
+
+// Called after every cart update
+void update_disk() {
+  if (w4_runtimeDiskWrites(runtime) != disk_writes_seen) {
+    disk_writes_seen = w4_runtimeDiskWrites(runtime);
+    // Playback brings the disk of the recording along, that's no save
+    if (w4_replayMode() == W4_REPLAY_PLAYING) {
+      return;
     }
-    fclose(file);
-    if (cart_length != 0) {
-      emulator_state = EmulatorState::CART_LOADING;
-      w4_wasmLoadModule(reinterpret_cast<const uint8_t *>(cart_bytes),
-                        cart_length);
-      emulator_state = EmulatorState::CART_LOADED;
+    if (!disk_pending) {
+      disk_pending = true;
+      disk_pending_frames = 0;
     }
+    disk_quiet_frames = 0;
+  } else if (disk_pending) {
+    ++disk_quiet_frames;
+  }
+  if (disk_pending) {
+    ++disk_pending_frames;
+    if (disk_quiet_frames >= disk_flush_quiet_frames ||
+        disk_pending_frames >= disk_flush_max_frames) {
+      flush_disk();
+    }
+  }
+}
+
+void flush_disk() {
+  if (!disk_pending) {
+    return;
+  }
+  disk_pending = false;
+  // Changed and then changed back, nothing to write
+  if (disk_storage_data.size == persisted_disk.size &&
+      memcmp(disk_storage_data.data, persisted_disk.data,
+             disk_storage_data.size) == 0) {
+    return;
+  }
+  blit::File file(disk_path, blit::OpenMode::write);
+  if (file.write(0, disk_storage_data.size,
+                 reinterpret_cast<const char *>(disk_storage_data.data)) ==
+      static_cast<int32_t>(disk_storage_data.size)) {
+    persisted_disk = disk_storage_data;
+  }
+}
+
+// Draws the background of an overlay in the left margin. Where the cart reaches
+// into the box (stretched on PicoSystem, which has no margin) it covers cart
+// pixels the dirty rows don't know about, so those rows are recomposited on the
+// next draw. That also erases the box once the overlay goes away.
+void overlay_box(const blit::Rect &box) {
+  blit::screen.pen = blit::Pen(0, 0, 0);
+  blit::screen.rectangle(box);
+  if (get_render() == GpuRenderer::STRETCH_RENDER) {
+    if (x_skip < box.x + box.w) {
+      // Every 3 screen rows show 2 framebuffer rows
+      w4_runtimeInvalidate(runtime, box.y / 3 * 2,
+                           (box.y + box.h - 1) / 3 * 2 + 2);
+    }
+  } else if (x_center_skip < box.x + box.w) {
+    w4_runtimeInvalidate(runtime, box.y - y_center_skip,
+                         box.y + box.h - y_center_skip);
+  }
+}
+
+// Shown in the top left corner, over the cart when it has no margin
+void render_replay_status() {
+  std::string status;
+  if (w4_replayMismatchFrame() >= 0) {
+    status = "DIFF " + std::to_string(w4_replayMismatchFrame());
+  } else if (w4_replayMode() == W4_REPLAY_RECORDING) {
+    status = "REC";
+  } else if (w4_replayMode() == W4_REPLAY_PLAYING) {
+    status = w4_replayFinished() ? "DONE" : "PLAY";
+  } else {
+    return;
+  }
+  overlay_box(blit::Rect(0, 0, 36, 10));
+  blit::screen.pen = blit::Pen(255, 0, 0);
+  blit::screen.text(status, blit::minimal_font, blit::Point(2, 2));
+}
+
+// Logical and composited frames per second, in the bottom left corner
+void render_rates() {
+  int height = turbo ? 29 : 20;
+  overlay_box(blit::Rect(0, TARGET_SIZE - height, 36, height));
+  blit::screen.pen = blit::Pen(255, 255, 255);
+  if (turbo) {
+    // Multiplier, and the fastest the cart could run drawing 60 Hz
+    blit::screen.text(std::to_string(turbo_multipliers[turbo_multiplier_idx]) +
+                          "x/" + std::to_string(max_speed_tenths / 10) + "x",
+                      blit::minimal_font, blit::Point(2, TARGET_SIZE - 27));
+  }
+  blit::screen.text("L " + std::to_string(logical_rate), blit::minimal_font,
+                    blit::Point(2, TARGET_SIZE - 18));
+  blit::screen.text("V " + std::to_string(visual_rate), blit::minimal_font,
+                    blit::Point(2, TARGET_SIZE - 9));
+}
+
+extern "C" uint32_t w4_profileNowUs() { return blit::now_us(); }
+
+void write_profile_csv(const char *text, int length) {
+  int32_t written = profile_csv.write(profile_csv_offset, length, text);
+  if (written > 0) {
+    profile_csv_offset += written;
+  }
+}
+
+void cycle_profile_mode() {
+  char header[1024];
+  switch (profile_mode) {
+  case ProfileMode::OFF:
+    profile_mode = ProfileMode::OVERLAY;
+    w4_profileSetEnabled(true);
+    break;
+  case ProfileMode::OVERLAY:
+    profile_mode = ProfileMode::CSV;
+    profile_csv.open(profile_csv_path, blit::OpenMode::write);
+    profile_csv_offset = 0;
+    write_profile_csv(header, w4_profileCsvHeader(header, sizeof(header)));
+    break;
+  case ProfileMode::CSV:
+    profile_mode = ProfileMode::OFF;
+    w4_profileSetEnabled(false);
+    profile_csv.close();
+    // Clear the side band the overlay was drawn in
+    full_redraw = true;
+    break;
+  }
+}
+
+// A profiled frame ends with each composite, and may span several cart updates
+void end_profile_frame() {
+  if (profile_mode == ProfileMode::OFF) {
+    return;
+  }
+  w4_profileEndFrame();
+  if (profile_mode == ProfileMode::CSV) {
+    char row[1024];
+    write_profile_csv(row, w4_profileCsvRow(row, sizeof(row)));
+  }
+}
+
+// Time and calls of each section that ran during the last profiled frame, in
+// the right side band
+void render_profile() {
+  if (profile_mode == ProfileMode::OFF || x_skip < 36) {
+    return;
+  }
+  int x = TARGET_WIDTH - x_skip;
+  auto band = blit::Rect(x, 0, x_skip, TARGET_SIZE);
+  blit::screen.pen = blit::Pen(0, 0, 0);
+  blit::screen.rectangle(band);
+  int y = 2;
+  for (int n = 0; n < W4_PROFILE_COUNT && y + 18 <= TARGET_SIZE - 10; n++) {
+    auto section = static_cast<w4_ProfileSection>(n);
+    if (w4_profileCalls(section) == 0) {
+      continue;
+    }
+    blit::screen.pen = blit::Pen(255, 255, 255);
+    blit::screen.text(w4_profileName(section), blit::minimal_font,
+                      blit::Point(x + 2, y), true, blit::TextAlign::top_left,
+                      band);
+    blit::screen.pen = blit::Pen(0, 255, 255);
+    blit::screen.text(std::to_string(w4_profileUs(section)) + " x" +
+                          std::to_string(w4_profileCalls(section)),
+                      blit::minimal_font, blit::Point(x + 2, y + 8), true,
+                      blit::TextAlign::top_left, band);
+    y += 18;
+  }
+  if (profile_mode == ProfileMode::CSV) {
+    blit::screen.pen = blit::Pen(255, 0, 0);
+    blit::screen.text("CSV", blit::minimal_font,
+                      blit::Point(x + 2, TARGET_SIZE - 9));
   }
-#endif
 }
 
 void render(uint32_t time) {
   blit::screen.alpha = 255;
   blit::screen.mask = nullptr;
   blit::screen.pen = blit::Pen(0, 0, 0);
-  blit::screen.clear();
+  if (emulator_state == EmulatorState::CART_LOADED && !full_redraw &&
+      !draw_pending) {
+    // The cart didn't advance, or is behind and needs the time more
+    return;
+  }
+  if (emulator_state != EmulatorState::CART_LOADED || full_redraw) {
+    blit::screen.clear();
+    // Whatever was composited before is gone, next draw recomposites all rows
+    w4_runtimeInvalidate(runtime, 0, WASM4_SIZE);
+    full_redraw = emulator_state != EmulatorState::CART_LOADED;
+  } else {
+    // Only the rows that changed get composited, so erase the old cursor
+    // ourselves and have the rows under it redrawn
+    blit::screen.rectangle(cursor_rect);
+    w4_runtimeInvalidate(runtime, cursor_row - 4, cursor_row + 5);
+  }
   if (emulator_state == EmulatorState::CART_SELECTION) {
     render_selector();
   } else if (emulator_state == EmulatorState::CART_LOADING) {
@@ -191,8 +584,23 @@ void render(uint32_t time) {
     blit::screen.rectangle(blit::Rect(0, 0, 320, 14));
     blit::screen.pen = blit::Pen(255, 0, 0);
     blit::screen.text("Loading ...", blit::minimal_font, blit::Point(5, 4));
+    blit::screen.text(cart_memory_text(), blit::minimal_font,
+                      blit::Point(5, 44));
+    if (compile_total > 0) {
+      blit::screen.text("Compiling " + std::to_string(compile_done) + "/" +
+                            std::to_string(compile_total),
+                        blit::minimal_font, blit::Point(5, 20));
+      blit::screen.pen = blit::Pen(255, 255, 255);
+      blit::screen.rectangle(
+          blit::Rect(5, 32, 230 * compile_done / compile_total, 6));
+    }
   } else {
-    w4_runtimeDraw();
+    uint32_t draw_start_us = blit::now_us();
+    w4_runtimeDraw(runtime);
+    draw_us += blit::now_us() - draw_start_us;
+    draw_pending = false;
+    frames_undrawn = 0;
+    ++visual_count;
     // White - Red Cursor
     blit::screen.pen = blit::Pen(255, 255, 255);
     int32_t x, y;
@@ -208,6 +616,12 @@ void render(uint32_t time) {
     blit::screen.circle(mouse_point, 3);
     blit::screen.pen = blit::Pen(255, 0, 0);
     blit::screen.circle(mouse_point,2);
+    cursor_rect = blit::Rect(x - 3, y - 3, 7, 7);
+    cursor_row = mouse_y;
+    render_replay_status();
+    render_rates();
+    render_profile();
+    end_profile_frame();
   }
 }
 
@@ -263,9 +677,54 @@ void capture_input() {
     mouse_y = 159;
   }
   // Set captured values
-  w4_runtimeSetGamepad(0, gamepad);
-  w4_runtimeSetGamepad(1, 0); // Disable game pad 2
-  w4_runtimeSetMouse(mouse_x, mouse_y, mouse_buttons);
+  w4_runtimeSetGamepad(runtime, 0, gamepad);
+  w4_runtimeSetGamepad(runtime, 1, 0); // Disable game pad 2
+  w4_runtimeSetMouse(runtime, mouse_x, mouse_y, mouse_buttons);
+}
+
+void reset_pacing() {
+  pacing_start_ms = blit::now();
+  pacing_frames = 0;
+  frames_undrawn = 0;
+  rate_window_start_ms = pacing_start_ms;
+  logical_count = 0;
+  visual_count = 0;
+  update_us = 0;
+  draw_us = 0;
+}
+
+// Runs one 60 Hz frame of the cart. Hidden frames are skipped by turbo, they
+// are never drawn and their tones are dropped.
+void step_cart(bool hidden) {
+  // Hold the joystick button and left to rewind, one captured state per frame.
+  // A recording can't follow the state jumping back, so not while one runs.
+  if (w4_replayMode() == W4_REPLAY_OFF &&
+      (blit::buttons & blit::Button::JOYSTICK) &&
+      (blit::buttons & blit::Button::DPAD_LEFT)) {
+    w4_savestateRewind(runtime);
+    frames_since_capture = 0;
+    return;
+  }
+  capture_input();
+  w4_replayBeginFrame();
+  w4_runtimeSetMuted(runtime, hidden);
+  w4_runtimeUpdate(runtime);
+  w4_runtimeSetMuted(runtime, false);
+  check_wasm();
+  w4_replayEndFrame();
+  if (!hidden) {
+    // Hidden frames take no time on the audio clock
+    w4_synthEndFrame();
+  }
+  update_disk();
+  if (w4_replayMode() == W4_REPLAY_RECORDING &&
+      w4_replayFrame() % replay_save_interval == 0) {
+    save_recording();
+  }
+  if (++frames_since_capture >= rewind_capture_interval) {
+    frames_since_capture = 0;
+    w4_savestateCapture(runtime);
+  }
 }
 
 void update(uint32_t time) {
@@ -273,14 +732,133 @@ void update(uint32_t time) {
     update_selector();
     return;
   }
-  capture_input();
-  w4_runtimeUpdate();
-  play_audio(time, prev_time_ms, first_time);
-  if (first_time) {
-    first_time = false;
-  } else {
-    prev_time_ms = time;
+  if (emulator_state == EmulatorState::CART_LOADING) {
+    update_loading();
+    return;
+  }
+
+  if ((blit::buttons & blit::Button::JOYSTICK) &&
+      (blit::buttons.pressed & blit::Button::DPAD_UP)) {
+    cycle_profile_mode();
+  }
+  if ((blit::buttons & blit::Button::JOYSTICK) &&
+      (blit::buttons.pressed & blit::Button::DPAD_RIGHT)) {
+    turbo = !turbo;
+    // The rates box changes size
+    full_redraw = true;
+  }
+  if ((blit::buttons & blit::Button::JOYSTICK) &&
+      (blit::buttons.pressed & blit::Button::DPAD_DOWN)) {
+    turbo_multiplier_idx = (turbo_multiplier_idx + 1) % turbo_multiplier_count;
+  }
+
+  uint32_t now = blit::now();
+  uint32_t due = (now - pacing_start_ms) * logical_fps / 1000;
+  // Turbo runs as fast as it can, falling behind there only drops time
+  uint32_t catch_up = turbo ? 1 : max_catch_up;
+  if (due > pacing_frames + catch_up) {
+    pacing_frames = due - catch_up;
+  }
+  int updates_per_frame = turbo ? turbo_multipliers[turbo_multiplier_idx] : 1;
+  for (; pacing_frames < due; ++pacing_frames) {
+    uint32_t update_start_us = blit::now_us();
+    for (int n = 1; n <= updates_per_frame; n++) {
+      step_cart(n < updates_per_frame);
+    }
+    update_us += blit::now_us() - update_start_us;
+    draw_pending = true;
+    ++frames_undrawn;
+    logical_count += updates_per_frame;
+  }
+  while (pacing_frames >= logical_fps) {
+    pacing_start_ms += 1000;
+    pacing_frames -= logical_fps;
+  }
+  // Another frame is due already, leave the composite for when it caught up
+  if (frames_undrawn < max_catch_up &&
+      (blit::now() - pacing_start_ms) * logical_fps / 1000 > pacing_frames) {
+    draw_pending = false;
+  }
+
+  if (now - rate_window_start_ms >= 1000) {
+    // Updates that fit in a 60 Hz frame next to one composite, over real time
+    if (logical_count > 0 && visual_count > 0 && update_us > 0) {
+      int64_t frame_us = 1000000 / logical_fps;
+      int64_t spare_us = frame_us - draw_us / visual_count;
+      max_speed_tenths = static_cast<int>(
+          std::max<int64_t>(0, spare_us * 10 * logical_count / update_us));
+    }
+    update_us = 0;
+    draw_us = 0;
+    logical_rate = logical_count;
+    visual_rate = visual_count;
+    logical_count = 0;
+    visual_count = 0;
+    rate_window_start_ms = now;
+  }
+}
+
+// How much RAM the cart bytes take, carts used in place take none
+std::string cart_memory_text() {
+  std::string size = std::to_string((cart_buffer.length + 1023) / 1024) + " KB";
+  switch (cart_buffer.storage) {
+  case CartStorage::IN_PLACE:
+    return "Cart: " + size + " read from flash, 0 KB RAM";
+  case CartStorage::MAPPED:
+    return "Cart: " + size + " mapped, 0 KB RAM";
+  case CartStorage::MALLOC:
+    return "Cart: " + size + " copied to RAM";
+  default:
+    return "";
+  }
+}
+
+void on_compile_progress(int compiled, int total) {
+  compile_done = compiled;
+  compile_total = total;
+}
+
+void update_loading() {
+  // Compiling everything up front means no stalls from lazy compilation
+  // once the cart runs
+  uint32_t slice_start = blit::now();
+  while (!w4_wasmCompileModule(w4_runtimeWasm(runtime), 8,
+                               on_compile_progress)) {
+    if (blit::now() - slice_start >= compile_slice_ms) {
+      return;
+    }
   }
+  check_wasm();
+  emulator_state = EmulatorState::CART_LOADED;
+  start_replay();
+  reset_pacing();
+}
+
+void start_replay() {
+  uint32_t cart_hash = w4_replayHash(cart_buffer.bytes, cart_buffer.length);
+  if (replay_request == ReplayRequest::RECORD) {
+    w4_replayStartRecording(runtime, cart_hash, replay_hash_interval);
+  } else if (replay_request == ReplayRequest::PLAY) {
+    // w4_replayStartPlayback() needs the recording for as long as it plays
+    blit::File file;
+    if (file.open(replay_path)) {
+      replay_bytes.resize(file.get_length());
+      if (file.read(0, replay_bytes.size(),
+                    reinterpret_cast<char *>(replay_bytes.data())) ==
+          static_cast<int32_t>(replay_bytes.size())) {
+        w4_replayStartPlayback(runtime, replay_bytes.data(),
+                               replay_bytes.size(), cart_hash);
+      }
+    }
+  }
+  replay_request = ReplayRequest::NONE;
+}
+
+void save_recording() {
+  int size;
+  const uint8_t *data = w4_replayData(&size);
+  blit::File file(replay_path, blit::OpenMode::write);
+  file.write(0, size, reinterpret_cast<const char *>(data));
 }
 
 void render_selector() {
@@ -289,10 +867,13 @@ void render_selector() {
   blit::screen.rectangle(blit::Rect(0, 0, 320, 14));
   blit::screen.rectangle(blit::Rect(0, TARGET_SIZE - 14, 320, 14));
   blit::screen.pen = blit::Pen(255, 0, 0);
-  blit::screen.text("Select wasm4 cart (Press X)", blit::minimal_font, blit::Point(5, 4));
-  blit::screen.text(std::string("Render Mode (Press Y to change): ") + (get_render() == GpuRenderer::STRETCH_RENDER ? "1.5x" : "1:1"),
+  blit::screen.text("Select wasm4 cart (Press X, A to record, B to replay)", blit::minimal_font, blit::Point(5, 4));
+  blit::screen.text(get_render() == GpuRenderer::STRETCH_RENDER
+                        ? "Render Mode (Press Y to change): 1.5x"
+                        : "Render Mode (Press Y to change): 1:1",
                     blit::minimal_font, blit::Point(5, TARGET_SIZE - 10));
-  if (cart_files.empty()) {
+  auto const &carts = cart_index();
+  if (carts.empty()) {
     return;
   }
   // Carts list
@@ -305,7 +886,7 @@ void render_selector() {
   }
   for (int i = 0; i < cart_file_render_max; i++) {
     int cur_index = cart_file_render_start + i;
-    if (cur_index >= (int)cart_files.size() || cur_index < 0) {
+    if (cur_index >= (int)carts.size() || cur_index < 0) {
       break;
     }
     if (cur_index == cart_file_idx) {
@@ -313,13 +894,13 @@ void render_selector() {
     } else {
       blit::screen.pen = blit::Pen(255, 255, 255);
     }
-    blit::screen.text(cart_files[cur_index], blit::minimal_font,
+    blit::screen.text(carts[cur_index].label, blit::minimal_font,
                       blit::Point(10, 20 + i * 20));
   }
 }
 
 void update_selector() {
-  if (cart_files.empty()) {
+  if (cart_index().empty()) {
     return;
   }
   if (blit::buttons.pressed & blit::Button::DPAD_UP) {
@@ -328,9 +909,17 @@ void update_selector() {
   } else if (blit::buttons.pressed & blit::Button::DPAD_DOWN) {
     cart_file_idx++;
     clamp_cart_idx();
-  } else if (blit::buttons.pressed & blit::Button::X) {
-    std::string cart_file_path = cart_files[cart_file_idx];
-    load_cart(cart_file_path);
+  } else if (blit::buttons.pressed &
+             (blit::Button::X | blit::Button::A | blit::Button::B)) {
+    if (blit::buttons.pressed & blit::Button::A) {
+      replay_request = ReplayRequest::RECORD;
+    } else if (blit::buttons.pressed & blit::Button::B) {
+      replay_request = ReplayRequest::PLAY;
+    } else {
+      replay_request = ReplayRequest::NONE;
+    }
+    cart_index_mark_played(cart_file_idx);
+    load_cart(cart_index()[cart_file_idx].path);
   } else if (blit::buttons.pressed & blit::Button::Y) {
     if (get_render() == GpuRenderer::CENTER_RENDER) {
       set_render(GpuRenderer::STRETCH_RENDER);
@@ -341,9 +930,9 @@ void update_selector() {
 }
 void clamp_cart_idx() {
   if (cart_file_idx < 0) {
-    cart_file_idx = (int)cart_files.size() - 1;
+    cart_file_idx = (int)cart_index().size() - 1;
   }
-  if (cart_file_idx >= (int)cart_files.size()) {
+  if (cart_file_idx >= (int)cart_index().size()) {
     cart_file_idx = 0;
   }
 }
@@ -0,0 +1,163 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "framebuffer.h"
+#include "host.h"
+#include "replay.h"
+#include "runtime.h"
+#include "wasm.h"
+
+// Runs many carts at once, each on its own runtime instance, to check a whole collection for
+// traps and rendering changes. Workers take the next cart off the list until none are left.
+
+typedef struct {
+    const char* path;
+
+    // Filled in by the worker
+    int frames;
+    uint64_t ns;
+    uint32_t framebufferHash;
+    char error[256];
+} Job;
+
+static Job* jobs;
+static int jobCount;
+static int nextJob;
+static pthread_mutex_t jobLock = PTHREAD_MUTEX_INITIALIZER;
+
+static int frames = 600;
+static bool eager;
+
+static Job* takeJob () {
+    pthread_mutex_lock(&jobLock);
+    Job* job = nextJob < jobCount ? &jobs[nextJob++] : NULL;
+    pthread_mutex_unlock(&jobLock);
+    return job;
+}
+
+static void runJob (Job* job) {
+    int length;
+    uint8_t* bytes = w4_hostReadFile(job->path, &length);
+    if (bytes == NULL) {
+        snprintf(job->error, sizeof(job->error), "could not read cart");
+        return;
+    }
+
+    // Every cart starts with an empty disk of its own
+    w4_Disk disk = {0};
+    w4_Runtime* runtime = w4_runtimeCreate(&disk);
+    if (runtime == NULL) {
+        snprintf(job->error, sizeof(job->error), "out of memory");
+        free(bytes);
+        return;
+    }
+    w4_Wasm* wasm = w4_runtimeWasm(runtime);
+    // Tones would all end up in the same audio callback
+    w4_runtimeSetMuted(runtime, true);
+
+    if (w4_wasmLoadModule(wasm, bytes, length) && eager) {
+        w4_wasmCompileModule(wasm, 0, NULL);
+    }
+
+    uint64_t start = w4_hostNowNs();
+    while (w4_wasmError(wasm) == NULL && job->frames < frames) {
+        w4_runtimeSetGamepad(runtime, 0, w4_hostDefaultInput(job->frames));
+        w4_runtimeUpdate(runtime);
+        ++job->frames;
+    }
+    job->ns = w4_hostNowNs() - start;
+
+    job->framebufferHash = w4_replayHash(w4_runtimeGetFramebuffer(runtime), WIDTH*HEIGHT >> 2);
+    if (w4_wasmError(wasm) != NULL) {
+        snprintf(job->error, sizeof(job->error), "%s", w4_wasmError(wasm));
+    }
+
+    // wasm3 keeps pointers into the cart until the runtime is gone
+    w4_runtimeDestroy(runtime);
+    free(bytes);
+}
+
+static void* worker (void* arg) {
+    Job* job;
+    while ((job = takeJob()) != NULL) {
+        runJob(job);
+    }
+    return NULL;
+}
+
+static void usage (const char* argv0) {
+    fprintf(stderr,
+        "Usage: %s [options] cart.wasm...\n"
+        "  --frames N      number of frames to run each cart (default 600)\n"
+        "  --threads N     carts to run at the same time (default one per CPU)\n"
+        "  --eager         compile every function at load instead of on first call\n", argv0);
+}
+
+int main (int argc, char** argv) {
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+    jobs = calloc(argc, sizeof(Job));
+    for (int n = 1; n < argc; ++n) {
+        if (strcmp(argv[n], "--frames") == 0 && n + 1 < argc) {
+            frames = atoi(argv[++n]);
+        } else if (strcmp(argv[n], "--threads") == 0 && n + 1 < argc) {
+            threads = atoi(argv[++n]);
+        } else if (strcmp(argv[n], "--eager") == 0) {
+            eager = true;
+        } else if (argv[n][0] == '-') {
+            usage(argv[0]);
+            return 1;
+        } else {
+            jobs[jobCount++].path = argv[n];
+        }
+    }
+    if (jobCount == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+    if (threads > jobCount) {
+        threads = jobCount;
+    }
+
+    uint64_t start = w4_hostNowNs();
+    pthread_t* pool = malloc(threads * sizeof(pthread_t));
+    int started = 0;
+    while (started < threads && pthread_create(&pool[started], NULL, worker, NULL) == 0) {
+        ++started;
+    }
+    if (started == 0) {
+        // No threads to be had, do the work here
+        worker(NULL);
+    }
+    for (int n = 0; n < started; ++n) {
+        pthread_join(pool[n], NULL);
+    }
+    uint64_t ns = w4_hostNowNs() - start;
+    free(pool);
+
+    // In the order given, whichever worker ran them
+    int failed = 0;
+    printf("%10s %8s %10s  %s\n", "fps", "frames", "hash", "cart");
+    for (int n = 0; n < jobCount; ++n) {
+        const Job* job = &jobs[n];
+        double fps = job->ns > 0 ? job->frames * 1e9 / job->ns : 0;
+        printf("%10.1f %8d   %08x  %s\n", fps, job->frames, (unsigned)job->framebufferHash, job->path);
+        if (job->error[0] != '\0') {
+            printf("%10s %8s %10s  %s\n", "", "", "", job->error);
+            ++failed;
+        }
+    }
+    printf("%d carts on %d threads in %.2f s, %d failed\n", jobCount, started > 0 ? started : 1,
+        ns / 1e9, failed);
+
+    free(jobs);
+    return failed > 0;
+}
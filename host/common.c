@@ -0,0 +1,45 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "host.h"
+#include "runtime.h"
+
+uint64_t w4_hostNowNs () {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+uint32_t w4_profileNowUs () {
+    return (uint32_t)(w4_hostNowNs() / 1000);
+}
+
+uint8_t* w4_hostReadFile (const char* path, int* length) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    uint8_t* bytes = size > 0 ? malloc(size) : NULL;
+    if (bytes != NULL && fread(bytes, 1, size, file) != (size_t)size) {
+        free(bytes);
+        bytes = NULL;
+    }
+    fclose(file);
+    *length = (int)size;
+    return bytes;
+}
+
+uint8_t w4_hostDefaultInput (int frame) {
+    static const uint8_t directions[] = {W4_BUTTON_RIGHT, W4_BUTTON_DOWN, W4_BUTTON_LEFT, W4_BUTTON_UP};
+    uint8_t gamepad = directions[(frame / 90) % 4];
+    if (frame % 60 < 5) {
+        gamepad |= W4_BUTTON_X;
+    }
+    return gamepad;
+}
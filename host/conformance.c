@@ -0,0 +1,664 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "framebuffer.h"
+#include "host.h"
+
+// Pixel exact conformance checks for the drawing primitives in src/framebuffer.c. Every case is
+// drawn by the real primitive and by the naive per-pixel rasteriser below, onto the same random
+// framebuffer contents, and the two have to match byte for byte. The CRC of each primitive's
+// output over all its cases is checked against a golden value too, which catches changes the
+// reference would share, like a different oval outline. After an intended change in output, run
+// with --update and paste the printed table over goldens[].
+//
+// With --bench every primitive and its reference are timed on the random cases.
+
+typedef enum {
+    HLINE,
+    VLINE,
+    RECT,
+    LINE,
+    OVAL,
+    BLIT,
+    BLIT_SUB,
+    TEXT,
+    TEXT_UTF8,
+    TEXT_UTF16,
+    PRIMITIVE_COUNT,
+} Primitive;
+
+static const char* const primitiveNames[PRIMITIVE_COUNT] = {
+    "hline", "vline", "rect", "line", "oval", "blit", "blitSub", "text", "textUtf8", "textUtf16",
+};
+
+static const uint32_t goldens[PRIMITIVE_COUNT] = {
+    0xb2171503, // hline
+    0x7e308a79, // vline
+    0x2d34e5ae, // rect
+    0x6dae0e78, // line
+    0xae8aa6c0, // oval
+    0x140e8ab6, // blit
+    0x267369b0, // blitSub
+    0x177c3c7f, // text
+    0xbd89cd86, // textUtf8
+    0x4931b9b2, // textUtf16
+};
+
+#define MAX_TEXT 24
+
+typedef struct {
+    uint8_t drawColors[2];
+    // x, y, width, height, srcX, srcY, stride, flags. Lines use the first four as x1, y1, x2, y2.
+    int args[8];
+    uint16_t text[MAX_TEXT];
+    int textLength;
+    // Seeds the framebuffer contents drawn over
+    uint32_t background;
+} Case;
+
+typedef struct {
+    uint8_t drawColors[2];
+    uint8_t framebuffer[WIDTH*HEIGHT >> 2];
+} Screen;
+
+// Big enough for any sprite the cases sample, rows of up to 264 pixels at 2bpp
+#define SPRITE_SIZE (40 * 1024)
+static uint8_t sprite[SPRITE_SIZE];
+
+// The built-in font as 1bpp glyphs, read back from w4_framebufferText()
+static uint8_t font[W4_FONT_GLYPHS * 8];
+
+static uint32_t rngState;
+
+static uint32_t rng () {
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return rngState;
+}
+
+static int rngRange (int min, int max) {
+    return min + (int)(rng() % (uint32_t)(max - min + 1));
+}
+
+static uint32_t crcTable[256];
+
+static void initCrc () {
+    for (uint32_t n = 0; n < 256; ++n) {
+        uint32_t crc = n;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+        }
+        crcTable[n] = crc;
+    }
+}
+
+static uint32_t crc32 (uint32_t crc, const uint8_t* data, int size) {
+    crc = ~crc;
+    for (int n = 0; n < size; ++n) {
+        crc = (crc >> 8) ^ crcTable[(crc ^ data[n]) & 0xff];
+    }
+    return ~crc;
+}
+
+static void fillBackground (Screen* screen, uint32_t seed) {
+    rngState = seed | 1;
+    for (int n = 0; n < (int)sizeof(screen->framebuffer); n += 4) {
+        uint32_t bytes = rng();
+        memcpy(screen->framebuffer + n, &bytes, 4);
+    }
+}
+
+// The reference rasteriser. Everything goes through refPoint(), with the clipping done per pixel.
+// Loops are only cut short at the screen edges, so huge sizes don't take forever.
+
+static int clampX (int x) {
+    return x < 0 ? 0 : x > WIDTH ? WIDTH : x;
+}
+
+static int clampY (int y) {
+    return y < 0 ? 0 : y > HEIGHT ? HEIGHT : y;
+}
+
+static void refPoint (Screen* screen, uint8_t color, int x, int y) {
+    if (x >= 0 && x < WIDTH && y >= 0 && y < HEIGHT) {
+        int idx = (WIDTH * y + x) >> 2;
+        int shift = (x & 0x3) << 1;
+        screen->framebuffer[idx] = (color << shift) | (screen->framebuffer[idx] & ~(0x3 << shift));
+    }
+}
+
+static void refSpan (Screen* screen, uint8_t color, int startX, int y, int endX) {
+    for (int x = clampX(startX); x < clampX(endX); ++x) {
+        refPoint(screen, color, x, y);
+    }
+}
+
+static void refHLine (Screen* screen, int x, int y, int len) {
+    uint8_t dc0 = screen->drawColors[0] & 0xf;
+    if (dc0 != 0) {
+        refSpan(screen, (dc0 - 1) & 0x3, x, y, x + len);
+    }
+}
+
+static void refVLine (Screen* screen, int x, int y, int len) {
+    uint8_t dc0 = screen->drawColors[0] & 0xf;
+    if (dc0 != 0) {
+        for (int yy = clampY(y); yy < clampY(y + len); ++yy) {
+            refPoint(screen, (dc0 - 1) & 0x3, x, yy);
+        }
+    }
+}
+
+static void refRect (Screen* screen, int x, int y, int width, int height) {
+    uint8_t dc0 = screen->drawColors[0] & 0xf;
+    uint8_t dc1 = (screen->drawColors[0] >> 4) & 0xf;
+    if (dc0 != 0) {
+        for (int yy = clampY(y); yy < clampY(y + height); ++yy) {
+            refSpan(screen, (dc0 - 1) & 0x3, x, yy, x + width);
+        }
+    }
+    // Degenerate rects still get their edges: a zero width one is two vertical lines, a zero
+    // height one two horizontal lines
+    if (dc1 != 0) {
+        uint8_t strokeColor = (dc1 - 1) & 0x3;
+        for (int yy = clampY(y); yy < clampY(y + height); ++yy) {
+            refPoint(screen, strokeColor, x, yy);
+            refPoint(screen, strokeColor, x + width - 1, yy);
+        }
+        refSpan(screen, strokeColor, x, y, x + width);
+        refSpan(screen, strokeColor, x, y + height - 1, x + width);
+    }
+}
+
+static void refLine (Screen* screen, int x1, int y1, int x2, int y2) {
+    uint8_t dc0 = screen->drawColors[0] & 0xf;
+    if (dc0 == 0) {
+        return;
+    }
+    if (y1 > y2) {
+        int swap = x1;
+        x1 = x2;
+        x2 = swap;
+        swap = y1;
+        y1 = y2;
+        y2 = swap;
+    }
+    int dx = abs(x2 - x1), sx = x1 < x2 ? 1 : -1;
+    int dy = y2 - y1;
+    int err = (dx > dy ? dx : -dy) / 2;
+    for (;;) {
+        refPoint(screen, (dc0 - 1) & 0x3, x1, y1);
+        if (x1 == x2 && y1 == y2) {
+            break;
+        }
+        int e2 = err;
+        if (e2 > -dx) {
+            err -= dy;
+            x1 += sx;
+        }
+        if (e2 < dy) {
+            err += dx;
+            y1++;
+        }
+    }
+}
+
+// The midpoint ellipse of the original WASM-4 implementation
+static void refOval (Screen* screen, int x, int y, int width, int height) {
+    uint8_t dc0 = screen->drawColors[0] & 0xf;
+    uint8_t dc1 = (screen->drawColors[0] >> 4) & 0xf;
+    if (dc1 == 0xf) {
+        return;
+    }
+    uint8_t strokeColor = (dc1 - 1) & 0x3;
+    uint8_t fillColor = (dc0 - 1) & 0x3;
+
+    int a = width - 1;
+    int b = height - 1;
+    int b1 = b % 2;
+    int north = y + height / 2;
+    int west = x;
+    int east = x + width - 1;
+    int south = north - b1;
+    int dx = 4 * (1 - a) * b * b;
+    int dy = 4 * (b1 + 1) * a * a;
+    int err = dx + dy + b1 * a * a;
+    a *= 8 * a;
+    b1 = 8 * b * b;
+
+    do {
+        refPoint(screen, strokeColor, east, north);
+        refPoint(screen, strokeColor, west, north);
+        refPoint(screen, strokeColor, west, south);
+        refPoint(screen, strokeColor, east, south);
+        if (dc0 != 0 && east - west > 1) {
+            refSpan(screen, fillColor, west + 1, north, east);
+            refSpan(screen, fillColor, west + 1, south, east);
+        }
+        int err2 = 2 * err;
+        if (err2 <= dy) {
+            north += 1;
+            south -= 1;
+            dy += a;
+            err += dy;
+        }
+        if (err2 >= dx || 2 * err > dy) {
+            west += 1;
+            east -= 1;
+            dx += b1;
+            err += dx;
+        }
+    } while (west <= east);
+
+    while (north - south < height) {
+        refPoint(screen, strokeColor, west - 1, north);
+        refPoint(screen, strokeColor, east + 1, north);
+        north += 1;
+        refPoint(screen, strokeColor, west - 1, south);
+        refPoint(screen, strokeColor, east + 1, south);
+        south -= 1;
+    }
+}
+
+static void refBlit (Screen* screen, const uint8_t* source, int dstX, int dstY, int width,
+    int height, int srcX, int srcY, int stride, int flags) {
+
+    bool bpp2 = flags & W4_BLIT_2BPP;
+    bool flipX = flags & W4_BLIT_FLIP_X;
+    bool flipY = flags & W4_BLIT_FLIP_Y;
+    bool rotate = flags & W4_BLIT_ROTATE;
+    uint16_t colors = screen->drawColors[0] | (screen->drawColors[1] << 8);
+
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            // Rotation is counter-clockwise, the flips apply before it
+            int sx = srcX + ((flipX != rotate) ? width - x - 1 : x);
+            int sy = srcY + (flipY ? height - y - 1 : y);
+            int bitIndex = sy * stride + sx;
+            int colorIdx;
+            if (bpp2) {
+                colorIdx = (source[bitIndex >> 2] >> (6 - ((bitIndex & 0x3) << 1))) & 0x3;
+            } else {
+                colorIdx = (source[bitIndex >> 3] >> (7 - (bitIndex & 0x7))) & 0x1;
+            }
+            uint8_t dc = (colors >> (colorIdx << 2)) & 0xf;
+            if (dc != 0) {
+                refPoint(screen, (dc - 1) & 0x3, dstX + (rotate ? y : x), dstY + (rotate ? x : y));
+            }
+        }
+    }
+}
+
+static void refText (Screen* screen, const uint16_t* text, int length, int x, int y) {
+    for (int n = 0, currentX = x; n < length; ++n) {
+        if (text[n] == 10) {
+            y += 8;
+            currentX = x;
+        } else {
+            refBlit(screen, font, currentX, y, 8, 8, 0, (text[n] - 32) << 3, 8, 0);
+            currentX += 8;
+        }
+    }
+}
+
+static void draw (Primitive primitive, const Case* c, w4_Framebuffer* fb) {
+    const int* a = c->args;
+    uint8_t bytes[MAX_TEXT + 1];
+    for (int n = 0; n < c->textLength; ++n) {
+        bytes[n] = (uint8_t)c->text[n];
+    }
+    bytes[c->textLength] = '\0';
+
+    switch (primitive) {
+        case HLINE: w4_framebufferHLine(fb, a[0], a[1], a[2]); break;
+        case VLINE: w4_framebufferVLine(fb, a[0], a[1], a[3]); break;
+        case RECT: w4_framebufferRect(fb, a[0], a[1], a[2], a[3]); break;
+        case LINE: w4_framebufferLine(fb, a[0], a[1], a[2], a[3]); break;
+        case OVAL: w4_framebufferOval(fb, a[0], a[1], a[2], a[3]); break;
+        case BLIT:
+            w4_framebufferBlit(fb, sprite, a[0], a[1], a[2], a[3], a[4], a[5], a[6],
+                a[7] & W4_BLIT_2BPP, a[7] & W4_BLIT_FLIP_X, a[7] & W4_BLIT_FLIP_Y, a[7] & W4_BLIT_ROTATE);
+            break;
+        case BLIT_SUB:
+            // What the blit and blitSub imports call
+            w4_framebufferBlitKernel(a[7])(fb, sprite, a[0], a[1], a[2], a[3], a[4], a[5], a[6]);
+            break;
+        case TEXT: w4_framebufferText(fb, bytes, a[0], a[1]); break;
+        case TEXT_UTF8: w4_framebufferTextUtf8(fb, bytes, c->textLength, a[0], a[1]); break;
+        case TEXT_UTF16: w4_framebufferTextUtf16(fb, c->text, c->textLength * 2, a[0], a[1]); break;
+        case PRIMITIVE_COUNT: break;
+    }
+}
+
+static void drawReference (Primitive primitive, const Case* c, Screen* screen) {
+    const int* a = c->args;
+    switch (primitive) {
+        case HLINE: refHLine(screen, a[0], a[1], a[2]); break;
+        case VLINE: refVLine(screen, a[0], a[1], a[3]); break;
+        case RECT: refRect(screen, a[0], a[1], a[2], a[3]); break;
+        case LINE: refLine(screen, a[0], a[1], a[2], a[3]); break;
+        case OVAL: refOval(screen, a[0], a[1], a[2], a[3]); break;
+        case BLIT:
+        case BLIT_SUB: refBlit(screen, sprite, a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7]); break;
+        case TEXT:
+        case TEXT_UTF8:
+        case TEXT_UTF16: refText(screen, c->text, c->textLength, a[0], a[1]); break;
+        case PRIMITIVE_COUNT: break;
+    }
+}
+
+// Positions around the screen edges and byte boundaries
+static const int edges[] = {-9, -8, -1, 0, 1, 3, 4, 152, 155, 156, 159, 160};
+#define EDGE_COUNT (int)(sizeof(edges) / sizeof(edges[0]))
+
+static const int sizes[] = {-1, 0, 1, 2, 3, 4, 5, 8, 9, 17};
+#define SIZE_COUNT (int)(sizeof(sizes) / sizeof(sizes[0]))
+
+static int randomCoord () {
+    switch (rng() % 8) {
+        case 0: return edges[rng() % EDGE_COUNT];
+        case 1: return rngRange(-1000, 1000);
+        default: return rngRange(-40, 200);
+    }
+}
+
+static int randomSize (int max) {
+    switch (rng() % 8) {
+        case 0: return sizes[rng() % SIZE_COUNT];
+        case 1: return rngRange(-20, 0);
+        case 2: return rngRange(0, max);
+        default: return rngRange(0, 64);
+    }
+}
+
+static void randomText (Case* c) {
+    c->textLength = rngRange(1, MAX_TEXT);
+    for (int n = 0; n < c->textLength; ++n) {
+        c->text[n] = rng() % 16 == 0 ? 10 : rngRange(32, 32 + W4_FONT_GLYPHS - 1);
+    }
+}
+
+// Fills in the geometry of a random case
+static void randomArgs (Primitive primitive, Case* c) {
+    int* a = c->args;
+    switch (primitive) {
+        case OVAL:
+            // The midpoint error terms overflow an int somewhere past 400 pixels
+            a[0] = randomCoord();
+            a[1] = randomCoord();
+            a[2] = rngRange(-8, 320);
+            a[3] = rngRange(-8, 320);
+            if (rng() % 2) {
+                a[2] = randomSize(40);
+                a[3] = randomSize(40);
+            }
+            break;
+        case LINE:
+            for (int n = 0; n < 4; ++n) {
+                a[n] = randomCoord();
+            }
+            break;
+        case BLIT:
+        case BLIT_SUB:
+            a[0] = randomCoord();
+            a[1] = randomCoord();
+            if (rng() % 16 == 0) {
+                // Very wide, to clip far outside the screen
+                a[2] = rngRange(0, 12000);
+                a[3] = rngRange(0, 2);
+            } else {
+                a[2] = randomSize(256);
+                a[3] = randomSize(256);
+            }
+            a[4] = rngRange(0, 8);
+            a[5] = rngRange(0, 8);
+            a[6] = (a[2] > 0 ? a[2] : 0) + a[4] + rngRange(0, 8);
+            a[7] = rng() & 0xf;
+            break;
+        case TEXT:
+        case TEXT_UTF8:
+        case TEXT_UTF16:
+            a[0] = randomCoord();
+            a[1] = randomCoord();
+            randomText(c);
+            break;
+        default:
+            a[0] = randomCoord();
+            a[1] = randomCoord();
+            a[2] = rng() % 16 == 0 ? rngRange(-100000, 100000) : randomSize(200);
+            a[3] = rng() % 16 == 0 ? rngRange(-100000, 100000) : randomSize(200);
+            break;
+    }
+}
+
+// Cases in three parts: every value of every drawColors nibble, a grid of edge positions and sizes,
+// and random ones. Returns how many there are, the random ones last.
+static int makeCases (Primitive primitive, int randomCount, Case** cases, int* firstRandom) {
+    int capacity = 64 + EDGE_COUNT * EDGE_COUNT * SIZE_COUNT * SIZE_COUNT + randomCount;
+    Case* list = calloc(capacity, sizeof(Case));
+    int count = 0;
+    rngState = 0x9e3779b9 + primitive;
+
+    for (int nibble = 0; nibble < 4; ++nibble) {
+        for (int value = 0; value < 16; ++value) {
+            Case* c = &list[count++];
+            randomArgs(primitive, c);
+            uint16_t colors = rng();
+            colors = (colors & ~(0xf << (nibble * 4))) | (value << (nibble * 4));
+            c->drawColors[0] = colors;
+            c->drawColors[1] = colors >> 8;
+            c->background = rng();
+        }
+    }
+
+    // Text has no size, only positions
+    int sizeCount = primitive >= TEXT ? 1 : SIZE_COUNT;
+    for (int ny = 0; ny < EDGE_COUNT; ++ny) {
+        for (int nx = 0; nx < EDGE_COUNT; ++nx) {
+            for (int nh = 0; nh < sizeCount; ++nh) {
+                for (int nw = 0; nw < sizeCount; ++nw) {
+                    Case* c = &list[count++];
+                    randomArgs(primitive, c);
+                    c->args[0] = edges[nx];
+                    c->args[1] = edges[ny];
+                    if (primitive == LINE) {
+                        // Endpoints from the same grid
+                        c->args[2] = edges[nw % EDGE_COUNT];
+                        c->args[3] = edges[(nh + nw) % EDGE_COUNT];
+                    } else if (primitive < TEXT) {
+                        c->args[2] = sizes[nw];
+                        c->args[3] = sizes[nh];
+                    }
+                    if (primitive == BLIT || primitive == BLIT_SUB) {
+                        // Every flag combination at every position, the sizes take turns
+                        c->args[6] = (sizes[nw] > 0 ? sizes[nw] : 0) + c->args[4];
+                        c->args[7] = (nw + nh * SIZE_COUNT) & 0xf;
+                    }
+                    c->drawColors[0] = rng();
+                    c->drawColors[1] = rng();
+                    c->background = rng();
+                }
+            }
+        }
+    }
+
+    *firstRandom = count;
+    for (int n = 0; n < randomCount; ++n) {
+        Case* c = &list[count++];
+        randomArgs(primitive, c);
+        c->drawColors[0] = rng();
+        c->drawColors[1] = rng();
+        c->background = rng();
+    }
+    *cases = list;
+    return count;
+}
+
+static void printCase (Primitive primitive, const Case* c) {
+    const int* a = c->args;
+    fprintf(stderr, "  %s(%d, %d, %d, %d", primitiveNames[primitive], a[0], a[1], a[2], a[3]);
+    if (primitive == BLIT || primitive == BLIT_SUB) {
+        fprintf(stderr, ", src %d %d, stride %d, flags %d", a[4], a[5], a[6], a[7]);
+    } else if (primitive >= TEXT) {
+        fprintf(stderr, ", %d chars", c->textLength);
+    }
+    fprintf(stderr, ") drawColors %02x %02x\n", c->drawColors[0], c->drawColors[1]);
+}
+
+// Sets up the font used by refText(), by drawing every glyph unclipped with colors 0 and 1
+static void readFont () {
+    static Screen screen;
+    w4_Framebuffer fb;
+    screen.drawColors[0] = 0x21;
+    w4_framebufferInit(&fb, screen.drawColors, screen.framebuffer);
+    for (int glyph = 0; glyph < W4_FONT_GLYPHS; ++glyph) {
+        uint8_t str[2] = {32 + glyph, '\0'};
+        w4_framebufferText(&fb, str, 0, 0);
+        for (int row = 0; row < 8; ++row) {
+            uint8_t bits = 0;
+            for (int x = 0; x < 8; ++x) {
+                int color = (screen.framebuffer[(WIDTH * row + x) >> 2] >> ((x & 3) << 1)) & 0x3;
+                bits |= color << (7 - x);
+            }
+            font[(glyph << 3) + row] = bits;
+        }
+    }
+}
+
+static void bench (Primitive primitive, const Case* cases, int count) {
+    static Screen screen;
+    w4_Framebuffer fb;
+    w4_framebufferInit(&fb, screen.drawColors, screen.framebuffer);
+    const int rounds = 20;
+
+    uint64_t start = w4_hostNowNs();
+    for (int round = 0; round < rounds; ++round) {
+        for (int n = 0; n < count; ++n) {
+            memcpy(screen.drawColors, cases[n].drawColors, 2);
+            draw(primitive, &cases[n], &fb);
+        }
+    }
+    double ns = (double)(w4_hostNowNs() - start) / (rounds * count);
+
+    start = w4_hostNowNs();
+    for (int round = 0; round < rounds; ++round) {
+        for (int n = 0; n < count; ++n) {
+            memcpy(screen.drawColors, cases[n].drawColors, 2);
+            drawReference(primitive, &cases[n], &screen);
+        }
+    }
+    double refNs = (double)(w4_hostNowNs() - start) / (rounds * count);
+
+    printf("%-10s %10.1f %12.1f %8.1fx\n", primitiveNames[primitive], ns, refNs, refNs / ns);
+}
+
+static void usage (const char* argv0) {
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  --cases N       random cases per primitive on top of the fixed ones (default 5000)\n"
+        "  --only NAME     check a single primitive\n"
+        "  --bench         time every primitive against the reference on the random cases\n"
+        "  --update        print the golden CRCs of the current output instead of checking them\n", argv0);
+}
+
+int main (int argc, char** argv) {
+    int randomCount = 5000;
+    const char* only = NULL;
+    bool benchmark = false;
+    bool update = false;
+
+    for (int n = 1; n < argc; ++n) {
+        if (strcmp(argv[n], "--cases") == 0 && n + 1 < argc) {
+            randomCount = atoi(argv[++n]);
+        } else if (strcmp(argv[n], "--only") == 0 && n + 1 < argc) {
+            only = argv[++n];
+        } else if (strcmp(argv[n], "--bench") == 0) {
+            benchmark = true;
+        } else if (strcmp(argv[n], "--update") == 0) {
+            update = true;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    initCrc();
+    rngState = 0x2545f491;
+    for (int n = 0; n < SPRITE_SIZE; ++n) {
+        sprite[n] = rng();
+    }
+    readFont();
+
+    static Screen screen;
+    static Screen expected;
+    w4_Framebuffer fb;
+    w4_framebufferInit(&fb, screen.drawColors, screen.framebuffer);
+
+    int failed = 0;
+    if (benchmark) {
+        printf("%-10s %10s %12s %9s\n", "primitive", "ns/call", "reference", "speedup");
+    }
+    for (int primitive = 0; primitive < PRIMITIVE_COUNT; ++primitive) {
+        if (only != NULL && strcmp(only, primitiveNames[primitive]) != 0) {
+            continue;
+        }
+        Case* cases;
+        int firstRandom;
+        int count = makeCases(primitive, randomCount, &cases, &firstRandom);
+
+        if (benchmark) {
+            bench(primitive, cases + firstRandom, count - firstRandom);
+            free(cases);
+            continue;
+        }
+
+        // The fixed cases alone make up the golden CRC, so it doesn't depend on --cases
+        uint32_t crc = 0;
+        int mismatches = 0;
+        for (int n = 0; n < count; ++n) {
+            const Case* c = &cases[n];
+            fillBackground(&screen, c->background);
+            memcpy(expected.framebuffer, screen.framebuffer, sizeof(screen.framebuffer));
+            memcpy(screen.drawColors, c->drawColors, 2);
+            memcpy(expected.drawColors, c->drawColors, 2);
+
+            draw(primitive, c, &fb);
+            drawReference(primitive, c, &expected);
+
+            if (memcmp(screen.framebuffer, expected.framebuffer, sizeof(screen.framebuffer)) != 0) {
+                if (mismatches++ == 0) {
+                    fprintf(stderr, "%s differs from the reference, first at case %d:\n",
+                        primitiveNames[primitive], n);
+                    printCase(primitive, c);
+                }
+            }
+            if (n < firstRandom) {
+                crc = crc32(crc, screen.framebuffer, sizeof(screen.framebuffer));
+            }
+        }
+        free(cases);
+
+        if (update) {
+            printf("    0x%08x, // %s\n", (unsigned)crc, primitiveNames[primitive]);
+        } else {
+            bool crcMatches = crc == goldens[primitive];
+            printf("%-10s %7d cases  %s  crc %08x%s\n", primitiveNames[primitive], count,
+                mismatches > 0 ? "FAIL" : "ok  ", (unsigned)crc, crcMatches ? "" : " (golden differs)");
+            if (mismatches > 0 || !crcMatches) {
+                ++failed;
+            }
+        }
+        if (mismatches > 0) {
+            fprintf(stderr, "%s: %d of %d cases differ\n", primitiveNames[primitive], mismatches, count);
+        }
+    }
+
+    if (!update && !benchmark) {
+        printf("%s\n", failed > 0 ? "FAILED" : "all primitives conform");
+    }
+    return failed > 0;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "netplay.h"
+
+uint64_t w4_hostNowNs ();
+
+// Returns the file's bytes in a malloc()ed buffer, NULL if it can't be read
+uint8_t* w4_hostReadFile (const char* path, int* length);
+
+// Without a script, tap X once a second and walk the d-pad around so most carts get past their
+// title screen and do some real work.
+uint8_t w4_hostDefaultInput (int frame);
+
+// Composite at 1.5x like the default 32blit renderer (240x240), or 1:1 (160x160)
+void w4_hostWindowSetStretch (bool enabled);
+
+// Width and height of the composited frame
+int w4_hostWindowSize ();
+
+// Framebuffer rows composited so far, summed over all frames
+int w4_hostWindowDirtyRows ();
+
+// Last composited frame, RGB888
+const uint8_t* w4_hostWindowPixels ();
+
+bool w4_hostWindowSavePpm (const char* path);
+
+// Netplay transport over UDP between two ports on localhost, one socket per process
+bool w4_hostUdpOpen (int localPort, int remotePort, w4_NetTransport* transport);
+void w4_hostUdpClose ();
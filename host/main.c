@@ -0,0 +1,626 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "framebuffer.h"
+#include "host.h"
+#include "loopback.h"
+#include "netplay.h"
+#include "profile.h"
+#include "replay.h"
+#include "runtime.h"
+#include "savestate.h"
+#include "wasm.h"
+
+typedef struct {
+    int frame;
+    int line;
+    uint8_t gamepad;
+    bool hasMouse;
+    int16_t mouseX;
+    int16_t mouseY;
+    uint8_t mouseButtons;
+} InputEvent;
+
+typedef struct {
+    InputEvent* events;
+    int count;
+    int next;
+    // Gamepad of the last event applied, held until the next one
+    uint8_t gamepad;
+} InputScript;
+
+typedef struct {
+    uint64_t* wasm;
+    uint64_t* clear;
+    uint64_t* composite;
+    uint64_t* frame;
+} FrameTimes;
+
+static w4_Disk disk;
+static w4_Runtime* runtime;
+
+// Accumulated by the link time wrappers during the current frame
+static uint64_t wasmNs;
+static uint64_t clearNs;
+
+void __real_w4_wasmCallStart (w4_Wasm* wasm);
+void __real_w4_wasmCallUpdate (w4_Wasm* wasm);
+void __real_w4_framebufferClear (w4_Framebuffer* fb);
+
+void __wrap_w4_wasmCallStart (w4_Wasm* wasm) {
+    uint64_t start = w4_hostNowNs();
+    __real_w4_wasmCallStart(wasm);
+    wasmNs += w4_hostNowNs() - start;
+}
+
+void __wrap_w4_wasmCallUpdate (w4_Wasm* wasm) {
+    uint64_t start = w4_hostNowNs();
+    __real_w4_wasmCallUpdate(wasm);
+    wasmNs += w4_hostNowNs() - start;
+}
+
+void __wrap_w4_framebufferClear (w4_Framebuffer* fb) {
+    uint64_t start = w4_hostNowNs();
+    __real_w4_framebufferClear(fb);
+    clearNs += w4_hostNowNs() - start;
+}
+
+// The runner stops at the first trap, like the 32blit frontend
+static void checkWasm () {
+    const char* error = w4_wasmError(w4_runtimeWasm(runtime));
+    if (error != NULL) {
+        fprintf(stderr, "%s\n", error);
+        exit(1);
+    }
+}
+
+static bool parseGamepad (const char* token, uint8_t* gamepad) {
+    if (isdigit((unsigned char)*token)) {
+        *gamepad = (uint8_t)strtol(token, NULL, 0);
+        return true;
+    }
+    *gamepad = 0;
+    for (; *token != '\0'; ++token) {
+        switch (tolower((unsigned char)*token)) {
+            case 'x': *gamepad |= W4_BUTTON_X; break;
+            case 'z': *gamepad |= W4_BUTTON_Z; break;
+            case 'l': *gamepad |= W4_BUTTON_LEFT; break;
+            case 'r': *gamepad |= W4_BUTTON_RIGHT; break;
+            case 'u': *gamepad |= W4_BUTTON_UP; break;
+            case 'd': *gamepad |= W4_BUTTON_DOWN; break;
+            case '-': break;
+            default: return false;
+        }
+    }
+    return true;
+}
+
+static int compareEvents (const void* a, const void* b) {
+    const InputEvent* ea = a;
+    const InputEvent* eb = b;
+    if (ea->frame != eb->frame) {
+        return ea->frame < eb->frame ? -1 : 1;
+    }
+    return ea->line < eb->line ? -1 : ea->line > eb->line;
+}
+
+// Script lines look like "<frame> <buttons> [<mouseX> <mouseY> <mouseButtons>]", where buttons
+// is a number or a combination of the letters xzlrud ("-" for none). Each line holds its state
+// until the next one, '#' starts a comment.
+static bool loadInputScript (const char* path, InputScript* script) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        return false;
+    }
+    int capacity = 0;
+    char line[256];
+    for (int lineNumber = 1; fgets(line, sizeof(line), file) != NULL; ++lineNumber) {
+        char* comment = strchr(line, '#');
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+        char buttons[32];
+        int frame, mouseX, mouseY, mouseButtons;
+        int fields = sscanf(line, "%d %31s %d %d %d", &frame, buttons, &mouseX, &mouseY, &mouseButtons);
+        if (fields <= 0) {
+            continue;
+        }
+        InputEvent event = {frame, lineNumber, 0, fields == 5, mouseX, mouseY, mouseButtons};
+        if (fields < 2 || (fields != 2 && fields != 5) || !parseGamepad(buttons, &event.gamepad)) {
+            fprintf(stderr, "%s:%d: malformed input line\n", path, lineNumber);
+            fclose(file);
+            return false;
+        }
+        if (script->count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            script->events = realloc(script->events, capacity * sizeof(InputEvent));
+        }
+        script->events[script->count++] = event;
+    }
+    fclose(file);
+    qsort(script->events, script->count, sizeof(InputEvent), compareEvents);
+    return true;
+}
+
+static void applyInputScript (InputScript* script, int frame) {
+    while (script->next < script->count && script->events[script->next].frame <= frame) {
+        const InputEvent* event = &script->events[script->next++];
+        script->gamepad = event->gamepad;
+        if (event->hasMouse) {
+            w4_runtimeSetMouse(runtime, event->mouseX, event->mouseY, event->mouseButtons);
+        }
+    }
+}
+
+// The other end of --netplay-loopback: plays player 2 with the default input shifted by a few
+// seconds, and only relays input like a real peer that keeps up
+static int peerFrames;
+static int peerReceived;
+static int peerAck;
+
+static void runLoopbackPeer () {
+    w4_NetTransport transport = w4_loopbackTransport(1);
+    uint8_t packet[W4_NETPLAY_MAX_PACKET];
+    uint8_t inputs[W4_NETPLAY_MAX_PACKET];
+    int size;
+    while ((size = transport.receive(transport.context, packet, sizeof(packet))) > 0) {
+        uint32_t ack, start;
+        int count;
+        if (w4_netplayDecode(packet, size, &ack, &start, inputs, &count)) {
+            if ((int)ack > peerAck) {
+                peerAck = ack;
+            }
+            if ((int)start <= peerReceived && (int)start + count > peerReceived) {
+                peerReceived = start + count;
+            }
+        }
+    }
+
+    if (peerFrames - peerReceived < W4_NETPLAY_MAX_ROLLBACK) {
+        ++peerFrames;
+    }
+    int count = peerFrames - peerAck;
+    for (int n = 0; n < count && n < (int)sizeof(inputs); ++n) {
+        inputs[n] = w4_hostDefaultInput(peerAck + n + 150);
+    }
+    size = w4_netplayEncode(packet, peerReceived, peerAck, inputs, count);
+    transport.send(transport.context, packet, size);
+}
+
+static int compareTimes (const void* a, const void* b) {
+    uint64_t ta = *(const uint64_t*)a;
+    uint64_t tb = *(const uint64_t*)b;
+    return ta < tb ? -1 : ta > tb;
+}
+
+static void printStats (const char* name, uint64_t* samples, int count) {
+    uint64_t total = 0;
+    for (int n = 0; n < count; ++n) {
+        total += samples[n];
+    }
+    qsort(samples, count, sizeof(uint64_t), compareTimes);
+    int p99 = (count * 99 + 99) / 100 - 1;
+    printf("%-10s %10.1f %10.1f %10.1f %10.1f %10.1f\n", name,
+        samples[0] / 1000.0, samples[count / 2] / 1000.0, samples[p99] / 1000.0,
+        samples[count - 1] / 1000.0, (double)total / count / 1000.0);
+}
+
+static int compareImportCalls (const void* a, const void* b) {
+    uint32_t ca = w4_wasmImportCalls(w4_runtimeWasm(runtime), *(const w4_WasmImport*)a);
+    uint32_t cb = w4_wasmImportCalls(w4_runtimeWasm(runtime), *(const w4_WasmImport*)b);
+    return ca > cb ? -1 : ca < cb;
+}
+
+// Imports the cart called during the measured frames, most called first
+static void printImportCalls (int frames) {
+    w4_WasmImport imports[W4_IMPORT_COUNT];
+    for (int n = 0; n < W4_IMPORT_COUNT; ++n) {
+        imports[n] = (w4_WasmImport)n;
+    }
+    qsort(imports, W4_IMPORT_COUNT, sizeof(w4_WasmImport), compareImportCalls);
+    printf("import calls per frame:");
+    for (int n = 0; n < W4_IMPORT_COUNT && w4_wasmImportCalls(w4_runtimeWasm(runtime), imports[n]) > 0; ++n) {
+        printf(" %s %.1f", w4_wasmImportName(imports[n]), (double)w4_wasmImportCalls(w4_runtimeWasm(runtime), imports[n]) / frames);
+    }
+    printf("\n");
+}
+
+static void usage (const char* argv0) {
+    fprintf(stderr,
+        "Usage: %s [options] [cart.wasm]\n"
+        "  --frames N      number of frames to run (default 600)\n"
+        "  --warmup N      leading frames left out of the statistics (default 0)\n"
+        "  --input FILE    scripted input, see loadInputScript() in host/main.c\n"
+        "  --ppm FILE      write the last composited frame as a PPM image\n"
+        "  --center        composite at 1:1 instead of the default 1.5x\n"
+        "  --eager         compile every function at load instead of on first call\n"
+        "  --savestate N   capture a rewind state every N frames and report its cost\n"
+        "  --turbo N       composite one of every N frames and mute the others, like the turbo\n"
+        "                  mode on the device\n"
+        "  --record FILE   record the input of the run, with a framebuffer hash every 60 frames\n"
+        "  --profile FILE  write the time and calls of every import and stage per frame as CSV\n"
+        "  --replay FILE   play a recording back and check its framebuffer hashes, runs for the\n"
+        "                  length of the recording unless --frames is given\n"
+        "  --netplay-loopback LATENCY\n"
+        "                  play as player 1 against a scripted player 2 in the same process, its\n"
+        "                  input arriving LATENCY frames late\n"
+        "  --netplay-loss PERCENT\n"
+        "                  drop this share of the loopback packets\n"
+        "  --netplay-udp PLAYER LOCALPORT REMOTEPORT\n"
+        "                  play as PLAYER (1 or 2) against another runner on localhost\n"
+        "  --netplay-delay N\n"
+        "                  apply local input N frames late, to roll back less often\n", argv0);
+}
+
+int main (int argc, char** argv) {
+    const char* cartPath = BLW4_DEFAULT_CART;
+    const char* inputPath = NULL;
+    const char* ppmPath = NULL;
+    const char* recordPath = NULL;
+    const char* replayPath = NULL;
+    const char* profilePath = NULL;
+    int frames = 0;
+    int warmup = 0;
+    bool eager = false;
+    int savestateInterval = 0;
+    int turbo = 1;
+    int netplayLatency = -1;
+    int netplayLoss = 0;
+    int netplayPlayer = 0;
+    int netplayLocalPort = 0;
+    int netplayRemotePort = 0;
+    int netplayDelay = 0;
+
+    for (int n = 1; n < argc; ++n) {
+        if (strcmp(argv[n], "--frames") == 0 && n + 1 < argc) {
+            frames = atoi(argv[++n]);
+        } else if (strcmp(argv[n], "--warmup") == 0 && n + 1 < argc) {
+            warmup = atoi(argv[++n]);
+        } else if (strcmp(argv[n], "--input") == 0 && n + 1 < argc) {
+            inputPath = argv[++n];
+        } else if (strcmp(argv[n], "--ppm") == 0 && n + 1 < argc) {
+            ppmPath = argv[++n];
+        } else if (strcmp(argv[n], "--record") == 0 && n + 1 < argc) {
+            recordPath = argv[++n];
+        } else if (strcmp(argv[n], "--profile") == 0 && n + 1 < argc) {
+            profilePath = argv[++n];
+        } else if (strcmp(argv[n], "--replay") == 0 && n + 1 < argc) {
+            replayPath = argv[++n];
+        } else if (strcmp(argv[n], "--netplay-loopback") == 0 && n + 1 < argc) {
+            netplayLatency = atoi(argv[++n]);
+        } else if (strcmp(argv[n], "--netplay-loss") == 0 && n + 1 < argc) {
+            netplayLoss = atoi(argv[++n]);
+        } else if (strcmp(argv[n], "--netplay-udp") == 0 && n + 3 < argc) {
+            netplayPlayer = atoi(argv[++n]);
+            netplayLocalPort = atoi(argv[++n]);
+            netplayRemotePort = atoi(argv[++n]);
+        } else if (strcmp(argv[n], "--netplay-delay") == 0 && n + 1 < argc) {
+            netplayDelay = atoi(argv[++n]);
+        } else if (strcmp(argv[n], "--turbo") == 0 && n + 1 < argc) {
+            turbo = atoi(argv[++n]);
+        } else if (strcmp(argv[n], "--savestate") == 0 && n + 1 < argc) {
+            savestateInterval = atoi(argv[++n]);
+        } else if (strcmp(argv[n], "--eager") == 0) {
+            eager = true;
+        } else if (strcmp(argv[n], "--center") == 0) {
+            w4_hostWindowSetStretch(false);
+        } else if (argv[n][0] == '-') {
+            usage(argv[0]);
+            return 1;
+        } else {
+            cartPath = argv[n];
+        }
+    }
+    if (recordPath != NULL && replayPath != NULL) {
+        fprintf(stderr, "--record and --replay can't be used together\n");
+        return 1;
+    }
+    bool netplayUdp = netplayPlayer != 0;
+    bool netplay = netplayLatency >= 0 || netplayUdp;
+    if (netplay && (recordPath != NULL || replayPath != NULL)) {
+        fprintf(stderr, "Netplay can't be combined with --record or --replay\n");
+        return 1;
+    }
+    if (netplayUdp && (netplayPlayer < 1 || netplayPlayer > 2 || netplayLatency >= 0)) {
+        fprintf(stderr, "--netplay-udp needs player 1 or 2, and can't be combined with --netplay-loopback\n");
+        return 1;
+    }
+
+    InputScript script = {0};
+    if (inputPath != NULL && !loadInputScript(inputPath, &script)) {
+        fprintf(stderr, "Could not read input script %s\n", inputPath);
+        return 1;
+    }
+
+    // wasm3 keeps pointers into the module bytes, this buffer lives until exit
+    int cartLength;
+    uint8_t* cartBytes = w4_hostReadFile(cartPath, &cartLength);
+    if (cartBytes == NULL) {
+        fprintf(stderr, "Could not read cart %s\n", cartPath);
+        return 1;
+    }
+
+    int replayLength = 0;
+    uint8_t* replayBytes = NULL;
+    if (replayPath != NULL && (replayBytes = w4_hostReadFile(replayPath, &replayLength)) == NULL) {
+        fprintf(stderr, "Could not read recording %s\n", replayPath);
+        return 1;
+    }
+
+    runtime = w4_runtimeCreate(&disk);
+    if (runtime == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    w4_Wasm* wasm = w4_runtimeWasm(runtime);
+
+    uint64_t loadStart = w4_hostNowNs();
+    w4_wasmLoadModule(wasm, cartBytes, cartLength);
+    uint64_t loadNs = w4_hostNowNs() - loadStart;
+    checkWasm();
+    uint64_t compileNs = 0;
+    if (eager) {
+        uint64_t compileStart = w4_hostNowNs();
+        w4_wasmCompileModule(wasm, 0, NULL);
+        compileNs = w4_hostNowNs() - compileStart;
+        checkWasm();
+    }
+
+    uint32_t cartHash = w4_replayHash(cartBytes, cartLength);
+    if (recordPath != NULL) {
+        w4_replayStartRecording(runtime, cartHash, 60);
+    } else if (replayBytes != NULL) {
+        if (!w4_replayStartPlayback(runtime, replayBytes, replayLength, cartHash)) {
+            fprintf(stderr, "%s isn't a recording of %s\n", replayPath, cartPath);
+            return 1;
+        }
+        if (frames == 0) {
+            frames = w4_replayLength();
+        }
+    }
+    if (frames == 0) {
+        frames = 600;
+    }
+    if (frames <= warmup || warmup < 0) {
+        fprintf(stderr, "--frames must be larger than --warmup\n");
+        return 1;
+    }
+    if (turbo < 1) {
+        fprintf(stderr, "--turbo must be at least 1\n");
+        return 1;
+    }
+
+    if (netplay) {
+        w4_NetTransport transport;
+        if (netplayUdp) {
+            if (!w4_hostUdpOpen(netplayLocalPort, netplayRemotePort, &transport)) {
+                fprintf(stderr, "Could not open UDP port %d\n", netplayLocalPort);
+                return 1;
+            }
+        } else {
+            w4_loopbackInit(netplayLatency, netplayLoss);
+            transport = w4_loopbackTransport(0);
+        }
+        if (!w4_netplayStart(runtime, transport, netplayUdp ? netplayPlayer - 1 : 0, netplayDelay)) {
+            fprintf(stderr, "Could not start netplay\n");
+            return 1;
+        }
+    }
+    // How long to wait for the remote side before giving up
+    uint64_t netplayTimeoutNs = 5000000000u;
+
+    w4_savestateInit(savestateInterval > 0 ? 4 << 20 : 0);
+    uint64_t captureNs = 0;
+    int captures = 0;
+
+    FILE* profileFile = NULL;
+    if (profilePath != NULL) {
+        if ((profileFile = fopen(profilePath, "w")) == NULL) {
+            fprintf(stderr, "Could not write %s\n", profilePath);
+            return 1;
+        }
+        char header[1024];
+        fwrite(header, 1, w4_profileCsvHeader(header, sizeof(header)), profileFile);
+        w4_profileSetEnabled(true);
+    }
+
+    int measured = frames - warmup;
+    FrameTimes times = {
+        malloc(measured * sizeof(uint64_t)),
+        malloc(measured * sizeof(uint64_t)),
+        malloc(measured * sizeof(uint64_t)),
+        malloc(measured * sizeof(uint64_t)),
+    };
+
+    int status = 0;
+    for (int frame = 0; frame < frames; ++frame) {
+        uint8_t gamepad;
+        if (inputPath != NULL) {
+            applyInputScript(&script, frame);
+            gamepad = script.gamepad;
+        } else {
+            gamepad = w4_hostDefaultInput(frame);
+        }
+
+        // With turbo only the last frame of every group is drawn and heard
+        bool hidden = frame % turbo != turbo - 1 && frame + 1 < frames;
+        w4_runtimeSetMuted(runtime, hidden);
+
+        wasmNs = 0;
+        clearNs = 0;
+        uint64_t frameStart = w4_hostNowNs();
+        if (netplay) {
+            if (!netplayUdp) {
+                w4_loopbackTick();
+                runLoopbackPeer();
+            }
+            // Stalled until the remote side catches up
+            while (!w4_netplayUpdate(gamepad)) {
+                if (w4_hostNowNs() - frameStart > netplayTimeoutNs) {
+                    fprintf(stderr, "Netplay timed out at frame %d\n", frame);
+                    frames = frame;
+                    status = 1;
+                    break;
+                }
+                if (netplayUdp) {
+                    nanosleep(&(struct timespec){0, 1000000}, NULL);
+                } else {
+                    w4_loopbackTick();
+                    runLoopbackPeer();
+                }
+            }
+            if (status != 0) {
+                break;
+            }
+        } else {
+            w4_runtimeSetGamepad(runtime, 0, gamepad);
+            // During playback this replaces the input set above
+            w4_replayBeginFrame();
+            w4_runtimeUpdate(runtime);
+        }
+        checkWasm();
+        uint64_t compositeStart = w4_hostNowNs();
+        if (!hidden) {
+            w4_runtimeDraw(runtime);
+        }
+        uint64_t frameEnd = w4_hostNowNs();
+        w4_runtimeSetMuted(runtime, false);
+
+        if (!w4_replayEndFrame() && w4_replayMismatchFrame() == frame) {
+            fprintf(stderr, "Frame %d doesn't match the recording\n", frame);
+        }
+
+        if (savestateInterval > 0 && frame % savestateInterval == 0) {
+            uint64_t captureStart = w4_hostNowNs();
+            captures += w4_savestateCapture(runtime);
+            captureNs += w4_hostNowNs() - captureStart;
+        }
+
+        if (profileFile != NULL) {
+            char row[1024];
+            w4_profileEndFrame();
+            fwrite(row, 1, w4_profileCsvRow(row, sizeof(row)), profileFile);
+        }
+
+        if (frame + 1 == warmup) {
+            w4_wasmResetImportCalls(wasm);
+        }
+        if (frame >= warmup) {
+            int n = frame - warmup;
+            times.wasm[n] = wasmNs;
+            times.clear[n] = clearNs;
+            times.composite[n] = frameEnd - compositeStart;
+            times.frame[n] = frameEnd - frameStart;
+        }
+    }
+
+    if (netplay && status == 0) {
+        // Wait for the remote input of the last frames, then linger so the remote side gets ours
+        uint64_t waitStart = w4_hostNowNs();
+        bool confirmed = false;
+        while (w4_hostNowNs() - waitStart < (confirmed ? netplayTimeoutNs / 50 : netplayTimeoutNs)) {
+            if (w4_netplayPoll()) {
+                if (!netplayUdp) {
+                    break;
+                }
+                if (!confirmed) {
+                    confirmed = true;
+                    waitStart = w4_hostNowNs();
+                }
+            }
+            if (netplayUdp) {
+                nanosleep(&(struct timespec){0, 1000000}, NULL);
+            } else {
+                w4_loopbackTick();
+                runLoopbackPeer();
+            }
+        }
+        if (!w4_netplayPoll()) {
+            fprintf(stderr, "Netplay timed out waiting for the last remote input\n");
+            status = 1;
+        }
+        w4_runtimeDraw(runtime);
+    }
+    if (frames <= warmup) {
+        return status;
+    }
+    measured = frames - warmup;
+
+    printf("cart: %s (%d bytes), load: %.1f ms, compile: %.1f ms, frames: %d (+%d warmup)\n",
+        cartPath, cartLength, loadNs / 1e6, compileNs / 1e6, measured, warmup);
+    printf("%-10s %10s %10s %10s %10s %10s\n", "us", "min", "median", "p99", "max", "mean");
+    printStats("wasm", times.wasm, measured);
+    printStats("clear", times.clear, measured);
+    printStats("composite", times.composite, measured);
+    printStats("frame", times.frame, measured);
+    printf("dirty rows per frame: %.1f\n", (double)w4_hostWindowDirtyRows() / frames);
+    // The fastest the cart could run, from the time the measured frames took
+    uint64_t totalNs = 0;
+    for (int n = 0; n < measured; ++n) {
+        totalNs += times.frame[n];
+    }
+    printf("throughput: %.0f frames per second, %.1fx real time", measured / (totalNs / 1e9),
+        measured / (totalNs / 1e9) / 60);
+    if (turbo > 1) {
+        printf(", drawing 1 of %d frames", turbo);
+    }
+    printf("\n");
+    printImportCalls(measured);
+    if (captures > 0) {
+        printf("savestates: %d captured, %.1f us each, %d kept in %d bytes (%d bytes each)\n",
+            captures, captureNs / 1000.0 / captures, w4_savestateCount(), w4_savestateBytes(),
+            w4_savestateBytes() / w4_savestateCount());
+    }
+    if (netplay) {
+        w4_NetplayStats stats = w4_netplayStats();
+        printf("netplay: %d frames, %d confirmed, %d stalls, %d rollbacks resimulating %d frames"
+            " (longest %d)\n", stats.frames, stats.confirmedFrames, stats.stalls, stats.rollbacks,
+            stats.resimulatedFrames, stats.maxRollback);
+        printf("netplay: %d snapshots, %.1f us each, %d restores, %.1f us each, framebuffer %08x\n",
+            stats.snapshots, stats.snapshots ? (double)stats.snapshotUs / stats.snapshots : 0.0,
+            stats.restores, stats.restores ? (double)stats.restoreUs / stats.restores : 0.0,
+            w4_replayHash(w4_runtimeGetFramebuffer(runtime), WIDTH*HEIGHT >> 2));
+        w4_netplayStop();
+        w4_hostUdpClose();
+    }
+
+    if (ppmPath != NULL && !w4_hostWindowSavePpm(ppmPath)) {
+        fprintf(stderr, "Could not write %s\n", ppmPath);
+    }
+
+    if (profileFile != NULL) {
+        fclose(profileFile);
+    }
+
+    if (recordPath != NULL) {
+        int size;
+        const uint8_t* data = w4_replayData(&size);
+        FILE* file = fopen(recordPath, "wb");
+        if (file == NULL || fwrite(data, 1, size, file) != (size_t)size) {
+            fprintf(stderr, "Could not write %s\n", recordPath);
+            status = 1;
+        }
+        if (file != NULL) {
+            fclose(file);
+        }
+        printf("recording: %d frames in %d bytes\n", w4_replayFrame(), size);
+    } else if (replayBytes != NULL) {
+        if (w4_replayMismatchFrame() >= 0) {
+            printf("replay: framebuffer differs from frame %d on\n", w4_replayMismatchFrame());
+            status = 2;
+        } else if (w4_replayFinished()) {
+            printf("replay: matched, recording ended after %d frames\n", w4_replayFrame());
+        } else {
+            printf("replay: matched\n");
+        }
+    }
+    w4_replayStop();
+
+    w4_runtimeDestroy(runtime);
+    return status;
+}
@@ -0,0 +1,64 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "host.h"
+
+static int udpSocket = -1;
+static struct sockaddr_in remote;
+
+static bool udpSend (void* context, const uint8_t* data, int size) {
+    return sendto(udpSocket, data, size, 0, (const struct sockaddr*)&remote, sizeof(remote)) == size;
+}
+
+static int udpReceive (void* context, uint8_t* data, int capacity) {
+    for (;;) {
+        ssize_t size = recv(udpSocket, data, capacity, 0);
+        if (size >= 0) {
+            return (int)size;
+        }
+        // Nothing waiting, or the remote side isn't listening yet (ICMP refused)
+        if (errno != EINTR && errno != ECONNREFUSED) {
+            return 0;
+        }
+    }
+}
+
+bool w4_hostUdpOpen (int localPort, int remotePort, w4_NetTransport* transport) {
+    udpSocket = socket(AF_INET, SOCK_DGRAM, 0);
+    if (udpSocket < 0) {
+        return false;
+    }
+    struct sockaddr_in local;
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    local.sin_port = htons(localPort);
+    memset(&remote, 0, sizeof(remote));
+    remote.sin_family = AF_INET;
+    remote.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    remote.sin_port = htons(remotePort);
+
+    if (bind(udpSocket, (const struct sockaddr*)&local, sizeof(local)) != 0
+            || fcntl(udpSocket, F_SETFL, O_NONBLOCK) != 0) {
+        w4_hostUdpClose();
+        return false;
+    }
+    transport->send = udpSend;
+    transport->receive = udpReceive;
+    transport->context = NULL;
+    return true;
+}
+
+void w4_hostUdpClose () {
+    if (udpSocket >= 0) {
+        close(udpSocket);
+        udpSocket = -1;
+    }
+}
@@ -0,0 +1,73 @@
+#include <stdio.h>
+
+#include "composite.h"
+#include "host.h"
+#include "window.h"
+
+#define WIDTH 160
+#define HEIGHT 160
+#define STRETCH_SIZE (WIDTH * 3 / 2)
+
+static uint8_t pixels[STRETCH_SIZE*STRETCH_SIZE*3];
+static bool stretch = true;
+static int dirtyRowCount;
+
+void w4_windowBoot (const char* title) {
+}
+
+void w4_windowComposite (const uint32_t* palette, const uint8_t* framebuffer, const uint8_t* dirtyRows) {
+    w4_compositeSetPalette(palette, W4_PIXEL_RGB888);
+    for (int y = 0; y < HEIGHT; ++y) {
+        dirtyRowCount += dirtyRows[y] != 0;
+    }
+    if (stretch) {
+        const int rowSize = STRETCH_SIZE*3;
+        for (int y = 0; y < HEIGHT; y += 2) {
+            if (!dirtyRows[y] && !dirtyRows[y + 1]) {
+                continue;
+            }
+            uint8_t* dst = pixels + y/2*3*rowSize;
+            w4_compositeRowsStretch(dst, dst + rowSize, dst + 2*rowSize,
+                framebuffer + y*(WIDTH >> 2), framebuffer + (y + 1)*(WIDTH >> 2));
+        }
+    } else {
+        for (int y = 0; y < HEIGHT; ++y) {
+            if (!dirtyRows[y]) {
+                continue;
+            }
+            w4_compositeRow(pixels + y*WIDTH*3, framebuffer + y*(WIDTH >> 2));
+        }
+    }
+}
+
+void w4_hostWindowSetStretch (bool enabled) {
+    stretch = enabled;
+}
+
+int w4_hostWindowSize () {
+    return stretch ? STRETCH_SIZE : WIDTH;
+}
+
+int w4_hostWindowDirtyRows () {
+    return dirtyRowCount;
+}
+
+const uint8_t* w4_hostWindowPixels () {
+    return pixels;
+}
+
+bool w4_hostWindowSavePpm (const char* path) {
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        return false;
+    }
+    int size = w4_hostWindowSize();
+    fprintf(file, "P6\n%d %d\n255\n", size, size);
+    bool ok = fwrite(pixels, 3, size*size, file) == (size_t)(size*size);
+    fclose(file);
+    return ok;
+}
+
+// There is no audio on the host, tones are dropped.
+void wasm4_tone_callback (int frequency, int duration, int volume, int flags) {
+}
@@ -1,15 +1,47 @@
 #include <wasm3.h>
 #include <m3_env.h>
+#include <m3_compile.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "../wasm.h"
+#include "../framebuffer.h"
+#include "../profile.h"
 #include "../runtime.h"
 
-static M3Environment* env;
-static M3Runtime* runtime;
-static M3Module* module;
+struct w4_Wasm {
+    w4_Runtime* runtime;
+    w4_Framebuffer* framebuffer;
 
-static M3Function* start;
-static M3Function* update;
+    M3Environment* env;
+    M3Runtime* m3;
+    M3Module* module;
+
+    M3Function* start;
+    M3Function* update;
+
+    // w4_wasmCompileModule() progress through module->functions
+    uint32_t compileNext;
+    int compiledCount;
+    int compileTotal;
+
+    uint32_t importCalls[W4_IMPORT_COUNT];
+
+    // Set once the cart trapped or failed to load
+    char error[256];
+};
+
+// Every import counts its calls, and while profiling its time too. The instance is the user data
+// of the wasm3 runtime the import was called from.
+//
+// The drawing imports call the framebuffer directly rather than going through the runtime. They
+// only run inside w4_runtimeUpdate(), which marks the memory they wrote once the cart returns.
+#define IMPORT_BEGIN(import) \
+    w4_Wasm* wasm = m3_GetUserData(runtime); \
+    ++wasm->importCalls[import]; \
+    uint32_t profileStart = w4_profileBegin()
+#define IMPORT_END(import) w4_profileEnd(W4_PROFILE_IMPORT + (import), profileStart)
 
 static m3ApiRawFunction (blit) {
     m3ApiGetArgMem(const uint8_t*, sprite);
@@ -18,7 +50,9 @@ static m3ApiRawFunction (blit) {
     m3ApiGetArg(int, width);
     m3ApiGetArg(int, height);
     m3ApiGetArg(int, flags);
-    w4_runtimeBlit(sprite, x, y, width, height, flags);
+    IMPORT_BEGIN(W4_IMPORT_BLIT);
+    w4_framebufferBlitKernel(flags)(wasm->framebuffer, sprite, x, y, width, height, 0, 0, width);
+    IMPORT_END(W4_IMPORT_BLIT);
     m3ApiSuccess();
 }
 
@@ -32,7 +66,9 @@ static m3ApiRawFunction (blitSub) {
     m3ApiGetArg(int, srcY);
     m3ApiGetArg(int, stride);
     m3ApiGetArg(int, flags);
-    w4_runtimeBlitSub(sprite, x, y, width, height, srcX, srcY, stride, flags);
+    IMPORT_BEGIN(W4_IMPORT_BLIT_SUB);
+    w4_framebufferBlitKernel(flags)(wasm->framebuffer, sprite, x, y, width, height, srcX, srcY, stride);
+    IMPORT_END(W4_IMPORT_BLIT_SUB);
     m3ApiSuccess();
 }
 
@@ -41,7 +77,9 @@ static m3ApiRawFunction (line) {
     m3ApiGetArg(int, y1);
     m3ApiGetArg(int, x2);
     m3ApiGetArg(int, y2);
-    w4_runtimeLine(x1, y1, x2, y2);
+    IMPORT_BEGIN(W4_IMPORT_LINE);
+    w4_framebufferLine(wasm->framebuffer, x1, y1, x2, y2);
+    IMPORT_END(W4_IMPORT_LINE);
     m3ApiSuccess();
 }
 
@@ -49,7 +87,9 @@ static m3ApiRawFunction (hline) {
     m3ApiGetArg(int, x);
     m3ApiGetArg(int, y);
     m3ApiGetArg(int, len);
-    w4_runtimeHLine(x, y, len);
+    IMPORT_BEGIN(W4_IMPORT_HLINE);
+    w4_framebufferHLine(wasm->framebuffer, x, y, len);
+    IMPORT_END(W4_IMPORT_HLINE);
     m3ApiSuccess();
 }
 
@@ -57,7 +97,9 @@ static m3ApiRawFunction (vline) {
     m3ApiGetArg(int, x);
     m3ApiGetArg(int, y);
     m3ApiGetArg(int, len);
-    w4_runtimeVLine(x, y, len);
+    IMPORT_BEGIN(W4_IMPORT_VLINE);
+    w4_framebufferVLine(wasm->framebuffer, x, y, len);
+    IMPORT_END(W4_IMPORT_VLINE);
     m3ApiSuccess();
 }
 
@@ -66,7 +108,9 @@ static m3ApiRawFunction (oval) {
     m3ApiGetArg(int, y);
     m3ApiGetArg(int, width);
     m3ApiGetArg(int, height);
-    w4_runtimeOval(x, y, width, height);
+    IMPORT_BEGIN(W4_IMPORT_OVAL);
+    w4_framebufferOval(wasm->framebuffer, x, y, width, height);
+    IMPORT_END(W4_IMPORT_OVAL);
     m3ApiSuccess();
 }
 
@@ -75,15 +119,19 @@ static m3ApiRawFunction (rect) {
     m3ApiGetArg(int, y);
     m3ApiGetArg(int, width);
     m3ApiGetArg(int, height);
-    w4_runtimeRect(x, y, width, height);
+    IMPORT_BEGIN(W4_IMPORT_RECT);
+    w4_framebufferRect(wasm->framebuffer, x, y, width, height);
+    IMPORT_END(W4_IMPORT_RECT);
     m3ApiSuccess();
 }
 
 static m3ApiRawFunction (text) {
-    m3ApiGetArgMem(const char*, str);
+    m3ApiGetArgMem(const uint8_t*, str);
     m3ApiGetArg(int, x);
     m3ApiGetArg(int, y);
-    w4_runtimeText(str, x, y);
+    IMPORT_BEGIN(W4_IMPORT_TEXT);
+    w4_framebufferText(wasm->framebuffer, str, x, y);
+    IMPORT_END(W4_IMPORT_TEXT);
     m3ApiSuccess();
 }
 
@@ -92,7 +140,9 @@ static m3ApiRawFunction (textUtf8) {
     m3ApiGetArg(int, byteLength);
     m3ApiGetArg(int, x);
     m3ApiGetArg(int, y);
-    w4_runtimeTextUtf8(str, byteLength, x, y);
+    IMPORT_BEGIN(W4_IMPORT_TEXT_UTF8);
+    w4_framebufferTextUtf8(wasm->framebuffer, str, byteLength, x, y);
+    IMPORT_END(W4_IMPORT_TEXT_UTF8);
     m3ApiSuccess();
 }
 
@@ -101,7 +151,9 @@ static m3ApiRawFunction (textUtf16) {
     m3ApiGetArg(int, byteLength);
     m3ApiGetArg(int, x);
     m3ApiGetArg(int, y);
-    w4_runtimeTextUtf16(str, byteLength, x, y);
+    IMPORT_BEGIN(W4_IMPORT_TEXT_UTF16);
+    w4_framebufferTextUtf16(wasm->framebuffer, str, byteLength, x, y);
+    IMPORT_END(W4_IMPORT_TEXT_UTF16);
     m3ApiSuccess();
 }
 
@@ -110,7 +162,9 @@ static m3ApiRawFunction (tone) {
     m3ApiGetArg(int, duration);
     m3ApiGetArg(int, volume);
     m3ApiGetArg(int, flags);
-    w4_runtimeTone(frequency, duration, volume, flags);
+    IMPORT_BEGIN(W4_IMPORT_TONE);
+    w4_runtimeTone(wasm->runtime, frequency, duration, volume, flags);
+    IMPORT_END(W4_IMPORT_TONE);
     m3ApiSuccess();
 }
 
@@ -118,54 +172,80 @@ static m3ApiRawFunction (diskr) {
     m3ApiReturnType(int);
     m3ApiGetArgMem(uint8_t*, dest);
     m3ApiGetArg(int, size);
-    m3ApiReturn(w4_runtimeDiskr(dest, size));
+    IMPORT_BEGIN(W4_IMPORT_DISKR);
+    int result = w4_runtimeDiskr(wasm->runtime, dest, size);
+    IMPORT_END(W4_IMPORT_DISKR);
+    m3ApiReturn(result);
 }
 
 static m3ApiRawFunction (diskw) {
     m3ApiReturnType(int);
     m3ApiGetArgMem(const uint8_t*, src);
     m3ApiGetArg(int, size);
-    m3ApiReturn(w4_runtimeDiskw(src, size));
+    IMPORT_BEGIN(W4_IMPORT_DISKW);
+    int result = w4_runtimeDiskw(wasm->runtime, src, size);
+    IMPORT_END(W4_IMPORT_DISKW);
+    m3ApiReturn(result);
 }
 
 static m3ApiRawFunction (trace) {
     m3ApiGetArgMem(const char*, str);
-    w4_runtimeTrace(str);
+    IMPORT_BEGIN(W4_IMPORT_TRACE);
+    w4_runtimeTrace(wasm->runtime, str);
+    IMPORT_END(W4_IMPORT_TRACE);
     m3ApiSuccess();
 }
 
 static m3ApiRawFunction (traceUtf8) {
     m3ApiGetArgMem(const uint8_t*, str);
     m3ApiGetArg(int, byteLength);
-    w4_runtimeTraceUtf8(str, byteLength);
+    IMPORT_BEGIN(W4_IMPORT_TRACE_UTF8);
+    w4_runtimeTraceUtf8(wasm->runtime, str, byteLength);
+    IMPORT_END(W4_IMPORT_TRACE_UTF8);
     m3ApiSuccess();
 }
 
 static m3ApiRawFunction (traceUtf16) {
     m3ApiGetArgMem(const uint16_t*, str);
     m3ApiGetArg(int, byteLength);
-    w4_runtimeTraceUtf16(str, byteLength);
+    IMPORT_BEGIN(W4_IMPORT_TRACE_UTF16);
+    w4_runtimeTraceUtf16(wasm->runtime, str, byteLength);
+    IMPORT_END(W4_IMPORT_TRACE_UTF16);
     m3ApiSuccess();
 }
 
 static m3ApiRawFunction (tracef) {
     m3ApiGetArgMem(const char*, str);
     m3ApiGetArgMem(const void*, stack);
-    w4_runtimeTracef(str, stack);
+    IMPORT_BEGIN(W4_IMPORT_TRACEF);
+    w4_runtimeTracef(wasm->runtime, str, stack);
+    IMPORT_END(W4_IMPORT_TRACEF);
     m3ApiSuccess();
 }
 
-static void check (M3Result result) {
-    if (result != m3Err_none) {
+static const char* const importNames[W4_IMPORT_COUNT] = {
+    "blit", "blitSub", "line", "hline", "vline", "oval", "rect", "text", "textUtf8", "textUtf16",
+    "tone", "diskr", "diskw", "trace", "traceUtf8", "traceUtf16", "tracef",
+};
+
+// Keeps the first error, the cart is stopped from then on
+static bool check (w4_Wasm* wasm, M3Result result) {
+    if (result != m3Err_none && wasm->error[0] == '\0') {
         M3ErrorInfo info;
-        m3_GetErrorInfo(runtime, &info);
-        fprintf(stderr, "WASM error: %s (%s)\n", result, info.message);
-        exit(1);
+        m3_GetErrorInfo(wasm->m3, &info);
+        snprintf(wasm->error, sizeof(wasm->error), "WASM error: %s (%s)", result, info.message);
     }
+    return result == m3Err_none;
 }
 
-uint8_t* w4_wasmInit () {
-    env = m3_NewEnvironment();
+w4_Wasm* w4_wasmInit (w4_Runtime* runtime, w4_Framebuffer* framebuffer) {
+    w4_Wasm* wasm = calloc(1, sizeof(*wasm));
+    if (wasm == NULL) {
+        return NULL;
+    }
+    wasm->runtime = runtime;
+    wasm->framebuffer = framebuffer;
+    wasm->env = m3_NewEnvironment();
 
     // This is an arbitrary limit corresponding to the implementation details
     // of the wasm3 interpreter. It's unrelated to the resource constraints of
@@ -176,27 +256,60 @@ uint8_t* w4_wasmInit () {
     // desktop platforms (from wasm3/platforms/app/main.c).
     uint32_t wasm3StackSize = 64 * 1024;
 
-    runtime = m3_NewRuntime(env, wasm3StackSize, NULL);
+    wasm->m3 = m3_NewRuntime(wasm->env, wasm3StackSize, wasm);
+    if (wasm->env == NULL || wasm->m3 == NULL) {
+        w4_wasmDestroy(wasm);
+        return NULL;
+    }
 
-    runtime->memory.maxPages = 1;
-    ResizeMemory(runtime, 1);
+    wasm->m3->memory.maxPages = 1;
+    ResizeMemory(wasm->m3, 1);
+    if (m3_GetMemory(wasm->m3, NULL, 0) == NULL) {
+        w4_wasmDestroy(wasm);
+        return NULL;
+    }
+    return wasm;
+}
 
-    return m3_GetMemory(runtime, NULL, 0);
+void w4_wasmDestroy (w4_Wasm* wasm) {
+    if (wasm == NULL) {
+        return;
+    }
+    // A loaded module belongs to the runtime and is freed with it
+    if (wasm->m3) {
+        m3_FreeRuntime(wasm->m3);
+    }
+    if (wasm->env) {
+        m3_FreeEnvironment(wasm->env);
+    }
+    free(wasm);
 }
 
-void w4_wasmDestroy () {
-    m3_FreeRuntime(runtime);
-    m3_FreeEnvironment(env);
+uint8_t* w4_wasmMemory (w4_Wasm* wasm) {
+    return m3_GetMemory(wasm->m3, NULL, 0);
 }
 
-void w4_wasmLoadModule (const uint8_t* wasmBuffer, int byteLength) {
-    check(m3_ParseModule(env, &module, wasmBuffer, byteLength));
+bool w4_wasmLoadModule (w4_Wasm* wasm, const uint8_t* wasmBuffer, int byteLength) {
+    if (!check(wasm, m3_ParseModule(wasm->env, &wasm->module, wasmBuffer, byteLength))) {
+        wasm->module = NULL;
+        return false;
+    }
+    M3Module* module = wasm->module;
+
+    wasm->compileNext = 0;
+    wasm->compiledCount = 0;
+    wasm->compileTotal = 0;
+    memset(wasm->importCalls, 0, sizeof(wasm->importCalls));
 
     // wasm3 will reallocate a new memory if the module doesn't import a memory. We set this to
     // prevent that from happening: https://github.com/aduros/wasm4/issues/292
     module->memoryImported = true;
 
-    check(m3_LoadModule(runtime, module));
+    if (!check(wasm, m3_LoadModule(wasm->m3, module))) {
+        m3_FreeModule(module);
+        wasm->module = NULL;
+        return false;
+    }
 
     m3_LinkRawFunction(module, "env", "blit", "v(iiiiii)", blit);
     m3_LinkRawFunction(module, "env", "blitSub", "v(iiiiiiiii)", blitSub);
@@ -221,38 +334,94 @@ void w4_wasmLoadModule (const uint8_t* wasmBuffer, int byteLength) {
 
 #ifndef NDEBUG
     M3ErrorInfo error;
-    m3_GetErrorInfo(runtime, &error);
+    m3_GetErrorInfo(wasm->m3, &error);
     if (error.result) {
         fprintf(stderr, "Error in load: %s: %s\n", error.result, error.message);
     }
 #endif
 
-    m3_FindFunction(&start, runtime, "start");
-    m3_FindFunction(&update, runtime, "update");
+    m3_FindFunction(&wasm->start, wasm->m3, "start");
+    m3_FindFunction(&wasm->update, wasm->m3, "update");
 
     // First call wasm built-in start
-    check(m3_RunStart(module));
+    if (!check(wasm, m3_RunStart(module))) {
+        return false;
+    }
 
     // Call WASI start functions
     M3Function* func;
-    m3_FindFunction(&func, runtime, "_start");
-    if (func) {
-        check(m3_CallV(func));
+    m3_FindFunction(&func, wasm->m3, "_start");
+    if (func && !check(wasm, m3_CallV(func))) {
+        return false;
+    }
+    m3_FindFunction(&func, wasm->m3, "_initialize");
+    if (func && !check(wasm, m3_CallV(func))) {
+        return false;
+    }
+    return true;
+}
+
+bool w4_wasmCompileModule (w4_Wasm* wasm, int budget, w4_WasmCompileProgress progress) {
+    M3Module* module = wasm->module;
+    if (module == NULL || wasm->error[0] != '\0') {
+        return true;
     }
-    m3_FindFunction(&func, runtime, "_initialize");
-    if (func) {
-        check(m3_CallV(func));
+    if (wasm->compileTotal == 0) {
+        // Imports have no body, and the start functions already ran and got compiled on the way
+        for (uint32_t n = 0; n < module->numFunctions; ++n) {
+            IM3Function function = &module->functions[n];
+            if (function->wasm) {
+                ++wasm->compileTotal;
+                if (function->compiled) {
+                    ++wasm->compiledCount;
+                }
+            }
+        }
+    }
+
+    for (int compiled = 0; wasm->compileNext < module->numFunctions; ++wasm->compileNext) {
+        IM3Function function = &module->functions[wasm->compileNext];
+        if (!function->wasm || function->compiled) {
+            continue;
+        }
+        if (budget > 0 && compiled++ == budget) {
+            return false;
+        }
+        if (!check(wasm, CompileFunction(function))) {
+            return true;
+        }
+        ++wasm->compiledCount;
+        if (progress) {
+            progress(wasm->compiledCount, wasm->compileTotal);
+        }
     }
+    return true;
 }
 
-void w4_wasmCallStart () {
-    if (start) {
-        check(m3_CallV(start));
+void w4_wasmCallStart (w4_Wasm* wasm) {
+    if (wasm->start && wasm->error[0] == '\0') {
+        check(wasm, m3_CallV(wasm->start));
     }
 }
 
-void w4_wasmCallUpdate () {
-    if (update) {
-        check(m3_CallV(update));
+void w4_wasmCallUpdate (w4_Wasm* wasm) {
+    if (wasm->update && wasm->error[0] == '\0') {
+        check(wasm, m3_CallV(wasm->update));
     }
 }
+
+const char* w4_wasmError (const w4_Wasm* wasm) {
+    return wasm->error[0] != '\0' ? wasm->error : NULL;
+}
+
+const char* w4_wasmImportName (w4_WasmImport import) {
+    return importNames[import];
+}
+
+uint32_t w4_wasmImportCalls (const w4_Wasm* wasm, w4_WasmImport import) {
+    return wasm->importCalls[import];
+}
+
+void w4_wasmResetImportCalls (w4_Wasm* wasm) {
+    memset(wasm->importCalls, 0, sizeof(wasm->importCalls));
+}
@@ -0,0 +1,145 @@
+#include "cart_index.hpp"
+#include "32blit.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unordered_map>
+
+// One line per cart: size, hash and last played order, then the path
+static const std::string index_path = "carts.idx";
+static const char *index_header = "blw4 cart index 1\n";
+static std::vector<CartEntry> entries;
+
+// FNV-1a like w4_replayHash(), read a chunk at a time
+static uint32_t hash_file(const std::string &path, uint32_t size) {
+  uint32_t hash = 2166136261u;
+  blit::File file;
+  if (!file.open(path)) {
+    return hash;
+  }
+  char chunk[512];
+  for (uint32_t offset = 0; offset < size;) {
+    int32_t read = file.read(offset, std::min<uint32_t>(sizeof(chunk), size - offset), chunk);
+    if (read <= 0) {
+      break;
+    }
+    for (int32_t n = 0; n < read; n++) {
+      hash = (hash ^ static_cast<uint8_t>(chunk[n])) * 16777619u;
+    }
+    offset += read;
+  }
+  return hash;
+}
+
+static std::string make_label(const CartEntry &entry) {
+  std::string name = entry.path;
+  size_t slash = name.find_last_of('/');
+  if (slash != std::string::npos) {
+    name = name.substr(slash + 1);
+  }
+  return name + "  (" + std::to_string((entry.size + 1023) / 1024) + " KB)";
+}
+
+static std::vector<CartEntry> load_index() {
+  std::vector<CartEntry> cached;
+  blit::File file;
+  if (!file.open(index_path)) {
+    return cached;
+  }
+  std::string text(file.get_length(), '\0');
+  if (file.read(0, text.size(), &text[0]) != static_cast<int32_t>(text.size()) ||
+      text.compare(0, strlen(index_header), index_header) != 0) {
+    return cached;
+  }
+  size_t line_start = strlen(index_header);
+  while (line_start < text.size()) {
+    size_t line_end = text.find('\n', line_start);
+    if (line_end == std::string::npos) {
+      break;
+    }
+    CartEntry entry;
+    unsigned long size, hash, last_played;
+    int path_start = 0;
+    if (sscanf(text.c_str() + line_start, "%lu %lx %lu %n", &size, &hash,
+               &last_played, &path_start) == 3 &&
+        line_start + path_start < line_end) {
+      entry.path = text.substr(line_start + path_start,
+                               line_end - line_start - path_start);
+      entry.size = size;
+      entry.hash = hash;
+      entry.last_played = last_played;
+      cached.push_back(entry);
+    }
+    line_start = line_end + 1;
+  }
+  return cached;
+}
+
+static void save_index() {
+  std::string text = index_header;
+  char fields[40];
+  for (auto const &entry : entries) {
+    snprintf(fields, sizeof(fields), "%lu %08lx %lu ",
+             static_cast<unsigned long>(entry.size),
+             static_cast<unsigned long>(entry.hash),
+             static_cast<unsigned long>(entry.last_played));
+    text += fields + entry.path + "\n";
+  }
+  blit::File file(index_path, blit::OpenMode::write);
+  file.write(0, text.size(), text.c_str());
+}
+
+void cart_index_update(const std::vector<CartFile> &found) {
+  std::vector<CartEntry> cached = load_index();
+  std::unordered_map<std::string, const CartEntry *> by_path;
+  for (auto const &entry : cached) {
+    by_path[entry.path] = &entry;
+  }
+
+  bool changed = cached.size() != found.size();
+  entries.clear();
+  entries.reserve(found.size());
+  for (auto const &file : found) {
+    auto it = by_path.find(file.path);
+    if (it != by_path.end() && it->second->size == file.size) {
+      entries.push_back(*it->second);
+    } else {
+      CartEntry entry;
+      entry.path = file.path;
+      entry.size = file.size;
+      entry.hash = hash_file(file.path, file.size);
+      // A cart replaced under the same name keeps its place in the history
+      entry.last_played = it != by_path.end() ? it->second->last_played : 0;
+      entries.push_back(entry);
+      changed = true;
+    }
+    entries.back().label = make_label(entries.back());
+  }
+  std::sort(entries.begin(), entries.end(),
+            [](const CartEntry &a, const CartEntry &b) { return a.path < b.path; });
+  if (changed) {
+    save_index();
+  }
+}
+
+const std::vector<CartEntry> &cart_index() { return entries; }
+
+void cart_index_mark_played(int idx) {
+  uint32_t latest = entries[cart_index_last_played()].last_played;
+  if (entries[idx].last_played != 0 && entries[idx].last_played == latest) {
+    return;
+  }
+  entries[idx].last_played = latest + 1;
+  save_index();
+}
+
+int cart_index_last_played() {
+  int last = 0;
+  for (int idx = 0; idx < static_cast<int>(entries.size()); idx++) {
+    if (entries[idx].last_played > entries[last].last_played) {
+      last = idx;
+    }
+  }
+  return last;
+}
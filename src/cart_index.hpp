@@ -0,0 +1,34 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Carts found at boot, cached in an index file so only new or changed carts
+// get read and hashed
+struct CartEntry {
+  std::string path;
+  uint32_t size = 0;
+  uint32_t hash = 0;
+  // Order in which carts were last played, 0 when never
+  uint32_t last_played = 0;
+  // What the cart list shows, built once
+  std::string label;
+};
+
+struct CartFile {
+  std::string path;
+  uint32_t size;
+};
+
+// Loads the cached index and brings it in line with found, keeping the
+// entries whose path and size didn't change and hashing the rest. The index
+// is written back when anything changed. Entries are sorted by path.
+void cart_index_update(const std::vector<CartFile> &found);
+
+const std::vector<CartEntry> &cart_index();
+
+// Records the cart as played last and saves the index
+void cart_index_mark_played(int idx);
+
+// The most recently played cart, 0 when none was played yet
+int cart_index_last_played();
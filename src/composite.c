@@ -0,0 +1,117 @@
+#include "composite.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "framebuffer.h"
+
+// Four packed pixels per framebuffer byte, 12 bytes in RGB888 and 8 in RGB565
+static uint8_t table[256][12];
+// Three packed pixels per pair of horizontal pixels (a, a+b, b), indexed by a framebuffer nibble
+static uint8_t tripleRow[16][9];
+// Three packed pixels for the blended row between two pairs, indexed by the upper nibble in the
+// low four bits and the lower nibble in the high four
+static uint8_t tripleMid[256][9];
+static uint32_t tablePalette[4];
+static w4_PixelFormat tableFormat;
+static bool tableValid;
+
+// Per channel average, rounding down
+static uint32_t blend (uint32_t color1, uint32_t color2) {
+    return ((color1 & 0xfefefe) >> 1) + ((color2 & 0xfefefe) >> 1) + (color1 & color2 & 0x010101);
+}
+
+int w4_compositePixelSize (w4_PixelFormat format) {
+    return format == W4_PIXEL_RGB565 ? 2 : 3;
+}
+
+uint8_t* w4_compositePack (uint8_t* dst, uint32_t color, w4_PixelFormat format) {
+    uint8_t r = color >> 16;
+    uint8_t g = color >> 8;
+    uint8_t b = color;
+    if (format == W4_PIXEL_RGB565) {
+        // Same bit layout as the 32blit SDK's RGB565 surfaces
+        uint16_t packed = (r >> 3) | ((g >> 2) << 5) | ((b >> 3) << 11);
+        memcpy(dst, &packed, sizeof(packed));
+        return dst + 2;
+    }
+    *dst++ = r;
+    *dst++ = g;
+    *dst++ = b;
+    return dst;
+}
+
+void w4_compositeSetPalette (const uint32_t* palette, w4_PixelFormat format) {
+    if (tableValid && format == tableFormat && memcmp(palette, tablePalette, sizeof(tablePalette)) == 0) {
+        return;
+    }
+    memcpy(tablePalette, palette, sizeof(tablePalette));
+    tableFormat = format;
+    tableValid = true;
+
+    for (int byte = 0; byte < 256; ++byte) {
+        uint8_t* dst = table[byte];
+        for (int shift = 0; shift < 8; shift += 2) {
+            dst = w4_compositePack(dst, palette[(byte >> shift) & 0x3], format);
+        }
+    }
+
+    for (int pair = 0; pair < 16; ++pair) {
+        uint32_t left = palette[pair & 0x3];
+        uint32_t right = palette[pair >> 2];
+
+        uint8_t* dst = tripleRow[pair];
+        dst = w4_compositePack(dst, left, format);
+        dst = w4_compositePack(dst, blend(left, right), format);
+        w4_compositePack(dst, right, format);
+    }
+
+    for (int quad = 0; quad < 256; ++quad) {
+        int upper = quad & 0xf;
+        int lower = quad >> 4;
+        uint32_t left = blend(palette[upper & 0x3], palette[lower & 0x3]);
+        uint32_t right = blend(palette[upper >> 2], palette[lower >> 2]);
+
+        uint8_t* dst = tripleMid[quad];
+        dst = w4_compositePack(dst, left, format);
+        dst = w4_compositePack(dst, blend(left, right), format);
+        w4_compositePack(dst, right, format);
+    }
+}
+
+void w4_compositeRow (uint8_t* dst, const uint8_t* src) {
+    if (tableFormat == W4_PIXEL_RGB565) {
+        for (int n = 0; n < WIDTH >> 2; ++n, dst += 8) {
+            memcpy(dst, table[src[n]], 8);
+        }
+    } else {
+        for (int n = 0; n < WIDTH >> 2; ++n, dst += 12) {
+            memcpy(dst, table[src[n]], 12);
+        }
+    }
+}
+
+// Each framebuffer byte holds two pairs, so it becomes six pixels on each of the three rows
+#define STRETCH_BYTE(tripleSize) \
+    for (int n = 0; n < WIDTH >> 2; ++n) { \
+        uint8_t upper = src0[n]; \
+        uint8_t lower = src1[n]; \
+        memcpy(dst0, tripleRow[upper & 0xf], tripleSize); \
+        memcpy(dst0 + tripleSize, tripleRow[upper >> 4], tripleSize); \
+        memcpy(dst1, tripleMid[(upper & 0xf) | (lower << 4 & 0xf0)], tripleSize); \
+        memcpy(dst1 + tripleSize, tripleMid[(upper >> 4) | (lower & 0xf0)], tripleSize); \
+        memcpy(dst2, tripleRow[lower & 0xf], tripleSize); \
+        memcpy(dst2 + tripleSize, tripleRow[lower >> 4], tripleSize); \
+        dst0 += 2 * tripleSize; \
+        dst1 += 2 * tripleSize; \
+        dst2 += 2 * tripleSize; \
+    }
+
+void w4_compositeRowsStretch (uint8_t* dst0, uint8_t* dst1, uint8_t* dst2,
+    const uint8_t* src0, const uint8_t* src1) {
+    if (tableFormat == W4_PIXEL_RGB565) {
+        STRETCH_BYTE(6)
+    } else {
+        STRETCH_BYTE(9)
+    }
+}
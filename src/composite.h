@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+
+typedef enum {
+    W4_PIXEL_RGB888,
+    W4_PIXEL_RGB565,
+} w4_PixelFormat;
+
+// Bytes written per output pixel
+int w4_compositePixelSize (w4_PixelFormat format);
+
+// Packs one 0xRRGGBB color into dst, returns the position after it
+uint8_t* w4_compositePack (uint8_t* dst, uint32_t color, w4_PixelFormat format);
+
+// Rebuilds the table that maps each framebuffer byte (four pixels) to four packed output pixels,
+// and the blend tables used by the 1.5x scaler. Cheap to call every frame, the tables are only
+// rebuilt when the palette or format changed.
+void w4_compositeSetPalette (const uint32_t* palette, w4_PixelFormat format);
+
+// Converts one 160 pixel framebuffer row at 1:1 scale using the current table
+void w4_compositeRow (uint8_t* dst, const uint8_t* src);
+
+// Converts two framebuffer rows into three 240 pixel rows at 1.5x. Every 2x2 block of pixels
+// becomes 3x3, the pixels in between are blended from their neighbours.
+void w4_compositeRowsStretch (uint8_t* dst0, uint8_t* dst1, uint8_t* dst2,
+    const uint8_t* src0, const uint8_t* src1);
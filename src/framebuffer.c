@@ -232,8 +232,23 @@ static const uint8_t font[1792] = {
     0x93, 0xff, 0x39, 0x39, 0x39, 0x81, 0xf9, 0x83
 };
 
-static const uint8_t* drawColors;
-static uint8_t* framebuffer;
+// Spreads a 1bpp sprite byte into 2bpp framebuffer order: the leftmost pixel (most significant
+// bit) lands in the lowest bit pair, each set pixel becomes 0b01.
+#define SPREAD2(n) n, n + 0x4000, n + 0x1000, n + 0x5000
+#define SPREAD4(n) SPREAD2(n), SPREAD2(n + 0x0400), SPREAD2(n + 0x0100), SPREAD2(n + 0x0500)
+#define SPREAD6(n) SPREAD4(n), SPREAD4(n + 0x0040), SPREAD4(n + 0x0010), SPREAD4(n + 0x0050)
+static const uint16_t spread1bpp[256] = {
+    SPREAD6(0x0000), SPREAD6(0x0004), SPREAD6(0x0001), SPREAD6(0x0005)
+};
+
+#if defined(_MSC_VER)
+#define W4_INLINE static __forceinline
+#else
+#define W4_INLINE static inline __attribute__((always_inline))
+#endif
+
+#define FONT_GLYPHS W4_FONT_GLYPHS
+_Static_assert(sizeof(font) >> 3 == FONT_GLYPHS, "W4_FONT_GLYPHS doesn't match the font");
 
 static int w4_min (int a, int b) {
     return a < b ? a : b;
@@ -243,42 +258,56 @@ static int w4_max (int a, int b) {
     return a > b ? a : b;
 }
 
-static void drawPoint (uint8_t color, int x, int y) {
+static void drawPoint (w4_Framebuffer* fb, uint8_t color, int x, int y) {
     int idx = (WIDTH * y + x) >> 2;
     int shift = (x & 0x3) << 1;
     int mask = 0x3 << shift;
-    framebuffer[idx] = (color << shift) | (framebuffer[idx] & ~mask);
+    fb->framebuffer[idx] = (color << shift) | (fb->framebuffer[idx] & ~mask);
 }
 
-static void drawPointUnclipped (uint8_t color, int x, int y) {
+static void drawPointUnclipped (w4_Framebuffer* fb, uint8_t color, int x, int y) {
     if (x >= 0 && x < WIDTH && y >= 0 && y < HEIGHT) {
-        drawPoint(color, x, y);
+        drawPoint(fb, color, x, y);
     }
 }
 
-static void drawHLine (uint8_t color, int startX, int y, int endX) {
-    int fillEnd = endX - (endX & 3);
-    int fillStart = w4_min((startX + 3) & ~3, fillEnd);
-
-    if (fillEnd - fillStart > 3) {
-        for (int xx = startX; xx < fillStart; xx++) {
-            drawPoint(color, xx, y);
+// Fills the clipped rectangle [startX, endX) x [startY, endY), which must not be empty. Each row is
+// a masked write for the partial byte at either end and a memset for the whole bytes in between.
+static void fillRect (w4_Framebuffer* fb, uint8_t color, int startX, int startY, int endX, int endY) {
+    const int rowSize = WIDTH >> 2;
+    uint8_t fill = color * 0x55;
+    int first = startX >> 2;
+    int last = (endX - 1) >> 2;
+    uint8_t firstMask = 0xff << ((startX & 0x3) << 1);
+    uint8_t lastMask = 0xff >> ((3 - ((endX - 1) & 0x3)) << 1);
+    uint8_t* dst = fb->framebuffer + rowSize * startY + first;
+
+    if (first == last) {
+        // A single byte column, this is every vertical line
+        uint8_t mask = firstMask & lastMask;
+        for (int y = startY; y < endY; ++y, dst += rowSize) {
+            *dst = (*dst & ~mask) | (fill & mask);
+        }
+    } else if (startX == 0 && endX == WIDTH) {
+        // Full width rows are contiguous
+        memset(dst, fill, rowSize * (endY - startY));
+    } else {
+        int middle = last - first - 1;
+        for (int y = startY; y < endY; ++y, dst += rowSize) {
+            dst[0] = (dst[0] & ~firstMask) | (fill & firstMask);
+            memset(dst + 1, fill, middle);
+            dst[middle + 1] = (dst[middle + 1] & ~lastMask) | (fill & lastMask);
         }
-
-        int from = (WIDTH * y + fillStart) >> 2;
-        int to = (WIDTH * y + fillEnd) >> 2;
-        uint8_t fillColor = color * 0x55;
-
-        memset(framebuffer+from, fillColor, to-from);
-        startX = fillEnd;
     }
+}
 
-    for (int xx = startX; xx < endX; xx++) {
-        drawPoint(color, xx, y);
+static void drawHLine (w4_Framebuffer* fb, uint8_t color, int startX, int y, int endX) {
+    if (startX < endX) {
+        fillRect(fb, color, startX, y, endX, y + 1);
     }
 }
 
-static void drawHLineUnclipped (uint8_t color, int startX, int y, int endX) {
+static void drawHLineUnclipped (w4_Framebuffer* fb, uint8_t color, int startX, int y, int endX) {
     if (y >= 0 && y < HEIGHT) {
         if (startX < 0) {
             startX = 0;
@@ -287,49 +316,77 @@ static void drawHLineUnclipped (uint8_t color, int startX, int y, int endX) {
             endX = WIDTH;
         }
         if (startX < endX) {
-            drawHLine(color, startX, y, endX);
+            drawHLine(fb, color, startX, y, endX);
         }
     }
 }
 
-void w4_framebufferInit (const uint8_t* drawColors_, uint8_t* framebuffer_) {
-    drawColors = drawColors_;
-    framebuffer = framebuffer_;
+void w4_framebufferInit (w4_Framebuffer* fb, const uint8_t* drawColors, uint8_t* framebuffer) {
+    fb->drawColors = drawColors;
+    fb->framebuffer = framebuffer;
+    fb->glyphCacheColors = fb->drawColors[0];
+    memset(fb->glyphCached, 0, sizeof(fb->glyphCached));
+    w4_framebufferMarkDirty(fb, 0, HEIGHT);
+}
+
+void w4_framebufferMarkDirty (w4_Framebuffer* fb, int startY, int endY) {
+    startY = w4_max(0, startY);
+    endY = w4_min(HEIGHT, endY);
+    if (startY < endY) {
+        memset(fb->forcedRows + startY, 1, endY - startY);
+    }
+}
+
+int w4_framebufferTakeDirtyRows (w4_Framebuffer* fb, uint8_t* dirtyRows) {
+    const int rowSize = WIDTH >> 2;
+    int count = 0;
+    for (int y = 0; y < HEIGHT; ++y) {
+        uint8_t* row = fb->framebuffer + y*rowSize;
+        uint8_t* last = fb->composited + y*rowSize;
+        bool dirty = fb->forcedRows[y] || memcmp(row, last, rowSize) != 0;
+        if (dirty) {
+            memcpy(last, row, rowSize);
+            ++count;
+        }
+        dirtyRows[y] = dirty;
+    }
+    memset(fb->forcedRows, 0, sizeof(fb->forcedRows));
+    return count;
 }
 
-void w4_framebufferClear () {
-    memset(framebuffer, 0, WIDTH*HEIGHT >> 2);
+void w4_framebufferClear (w4_Framebuffer* fb) {
+    memset(fb->framebuffer, 0, WIDTH*HEIGHT >> 2);
 }
 
-void w4_framebufferHLine (int x, int y, int len) {
-    uint8_t dc0 = drawColors[0] & 0xf;
+void w4_framebufferHLine (w4_Framebuffer* fb, int x, int y, int len) {
+    uint8_t dc0 = fb->drawColors[0] & 0xf;
     if (dc0 == 0) {
         return;
     }
 
     uint8_t strokeColor = (dc0 - 1) & 0x3;
-    drawHLineUnclipped(strokeColor, x, y, x + len);
+    drawHLineUnclipped(fb, strokeColor, x, y, x + len);
 }
 
-void w4_framebufferVLine (int x, int y, int len) {
+void w4_framebufferVLine (w4_Framebuffer* fb, int x, int y, int len) {
     if (y + len <= 0 || x < 0 || x >= WIDTH) {
         return;
     }
 
-    uint8_t dc0 = drawColors[0] & 0xf;
+    uint8_t dc0 = fb->drawColors[0] & 0xf;
     if (dc0 == 0) {
         return;
     }
 
     int startY = w4_max(0, y);
     int endY = w4_min(HEIGHT, y + len);
-    uint8_t strokeColor = (dc0 - 1) & 0x3;
-    for (int yy = startY; yy < endY; yy++) {
-        drawPoint(strokeColor, x, yy);
+    if (startY < endY) {
+        uint8_t strokeColor = (dc0 - 1) & 0x3;
+        fillRect(fb, strokeColor, x, startY, x + 1, endY);
     }
 }
 
-void w4_framebufferRect (int x, int y, int width, int height) {
+void w4_framebufferRect (w4_Framebuffer* fb, int x, int y, int width, int height) {
     int startX = w4_max(0, x);
     int startY = w4_max(0, y);
     int endXUnclamped = x + width;
@@ -337,46 +394,68 @@ void w4_framebufferRect (int x, int y, int width, int height) {
     int endX = w4_min(endXUnclamped, WIDTH);
     int endY = w4_min(endYUnclamped, HEIGHT);
 
-    uint8_t dc01 = drawColors[0];
+    uint8_t dc01 = fb->drawColors[0];
     uint8_t dc0 = dc01 & 0xf;
     uint8_t dc1 = (dc01 >> 4) & 0xf;
 
-    if (dc0 != 0) {
+    if (dc0 != 0 && startX < endX && startY < endY) {
         uint8_t fillColor = (dc0 - 1) & 0x3;
-        for (int yy = startY; yy < endY; ++yy) {
-            drawHLine(fillColor, startX, yy, endX);
-        }
+        fillRect(fb, fillColor, startX, startY, endX, endY);
     }
 
     if (dc1 != 0) {
         uint8_t strokeColor = (dc1 - 1) & 0x3;
 
         // Left edge
-        if (x >= 0 && x < WIDTH) {
-            for (int yy = startY; yy < endY; ++yy) {
-                drawPoint(strokeColor, x, yy);
-            }
+        if (x >= 0 && x < WIDTH && startY < endY) {
+            fillRect(fb, strokeColor, x, startY, x + 1, endY);
         }
 
         // Right edge
-        if (endXUnclamped >= 0 && endXUnclamped <= WIDTH) {
-            for (int yy = startY; yy < endY; ++yy) {
-                drawPoint(strokeColor, endXUnclamped - 1, yy);
-            }
+        if (endXUnclamped > 0 && endXUnclamped <= WIDTH && startY < endY) {
+            fillRect(fb, strokeColor, endXUnclamped - 1, startY, endXUnclamped, endY);
         }
 
         // Top edge
         if (y >= 0 && y < HEIGHT) {
-            drawHLine(strokeColor, startX, y, endX);
+            drawHLine(fb, strokeColor, startX, y, endX);
         }
 
         // Bottom edge
-        if (endYUnclamped >= 0 && endYUnclamped <= HEIGHT) {
-            drawHLine(strokeColor, startX, endYUnclamped - 1, endX);
+        if (endYUnclamped > 0 && endYUnclamped <= HEIGHT) {
+            drawHLine(fb, strokeColor, startX, endYUnclamped - 1, endX);
         }
     }
 }
 
+// Draws one finished row of an oval: the outline from outerWest to innerWest and from innerEast to
+// outerEast, and the fill in between
+W4_INLINE void drawOvalRow (w4_Framebuffer* fb, int y, uint8_t strokeColor, bool fill, uint8_t fillColor,
+    int outerWest, int innerWest, int innerEast, int outerEast) {
+    if (y < 0 || y >= HEIGHT) {
+        return;
+    }
+    if (innerEast - innerWest <= 1) {
+        // The two sides of the outline meet
+        drawHLineUnclipped(fb, strokeColor, outerWest, y, outerEast + 1);
+        return;
+    }
+    // Along the steep sides the outline is a single point per row
+    if (outerWest == innerWest) {
+        drawPointUnclipped(fb, strokeColor, outerWest, y);
+    } else {
+        drawHLineUnclipped(fb, strokeColor, outerWest, y, innerWest + 1);
+    }
+    if (fill) {
+        drawHLineUnclipped(fb, fillColor, innerWest + 1, y, innerEast);
+    }
+    if (innerEast == outerEast) {
+        drawPointUnclipped(fb, strokeColor, outerEast, y);
+    } else {
+        drawHLineUnclipped(fb, strokeColor, innerEast, y, outerEast + 1);
+    }
+}
+
 // Oval drawing function using a variation on the midpoint algorithm.
 // TIC-80's ellipse drawing function used as reference.
 // https://github.com/nesbox/TIC-80/blob/main/src/core/draw.c
@@ -389,9 +468,16 @@ void w4_framebufferRect (int x, int y, int width, int height) {
 //
 // There are a lot of details to get correct while implementing this algorithm,
 // so ensure the edge cases are covered when changing it. Long, thin ellipses
-// are particularly susceptible to being drawn incorrectly.
-void w4_framebufferOval (int x, int y, int width, int height) {
-    uint8_t dc01 = drawColors[0];
+// are particularly susceptible to being drawn incorrectly. host/conformance.c
+// checks it against the original point by point version.
+//
+// The scan stays on a row pair (north and south) for several horizontal steps
+// on wide ovals. Each step used to plot its outline points and fill the row
+// again, instead the row is drawn once the scan leaves it: the outline runs
+// from the first west (east) on the row to the last one, and the fill is the
+// span between the last ones, which is what the overdrawing ended up with.
+void w4_framebufferOval (w4_Framebuffer* fb, int x, int y, int width, int height) {
+    uint8_t dc01 = fb->drawColors[0];
     uint8_t dc0 = dc01 & 0xf;
     uint8_t dc1 = (dc01 >> 4) & 0xf;
 
@@ -422,19 +508,35 @@ void w4_framebufferOval (int x, int y, int width, int height) {
     a *= 8 * a;
     b1 = 8 * b * b;
 
+    // Empty and negative sizes make the scan run backwards, those keep plotting
+    // every step
+    bool rows = width > 0 && height > 0;
+    int rowWest = west;
+    int rowEast = east;
+
     do {
-        drawPointUnclipped(strokeColor, east, north); /*   I. Quadrant     */
-        drawPointUnclipped(strokeColor, west, north); /*   II. Quadrant    */
-        drawPointUnclipped(strokeColor, west, south); /*   III. Quadrant   */
-        drawPointUnclipped(strokeColor, east, south); /*   IV. Quadrant    */
-        const start = west + 1;
-        const len = east - start;
-        if (dc0 != 0 && len > 0) { // Only draw fill if the length from west to east is not 0
-            drawHLineUnclipped(fillColor, start, north, east); /*   I and III. Quadrant */
-            drawHLineUnclipped(fillColor, start, south, east); /*  II and IV. Quadrant */
+        if (!rows) {
+            drawPointUnclipped(fb, strokeColor, east, north); /*   I. Quadrant     */
+            drawPointUnclipped(fb, strokeColor, west, north); /*   II. Quadrant    */
+            drawPointUnclipped(fb, strokeColor, west, south); /*   III. Quadrant   */
+            drawPointUnclipped(fb, strokeColor, east, south); /*   IV. Quadrant    */
+            const int start = west + 1;
+            const int len = east - start;
+            if (dc0 != 0 && len > 0) { // Only draw fill if the length from west to east is not 0
+                drawHLineUnclipped(fb, fillColor, start, north, east); /*   I and III. Quadrant */
+                drawHLineUnclipped(fb, fillColor, start, south, east); /*  II and IV. Quadrant */
+            }
         }
-        const err2 = 2 * err;
-        if (err2 <= dy) {
+        const int err2 = 2 * err;
+        const bool vertical = err2 <= dy;
+        if (vertical) {
+            if (rows) {
+                // Leaving the row pair, west and east are as far in as they get on it
+                drawOvalRow(fb, north, strokeColor, dc0 != 0, fillColor, rowWest, west, east, rowEast);
+                if (south != north) {
+                    drawOvalRow(fb, south, strokeColor, dc0 != 0, fillColor, rowWest, west, east, rowEast);
+                }
+            }
             // Move vertical scan
             north += 1;
             south -= 1;
@@ -448,21 +550,33 @@ void w4_framebufferOval (int x, int y, int width, int height) {
             dx += b1;
             err += dx;
         }
+        if (vertical) {
+            rowWest = west;
+            rowEast = east;
+        }
     } while (west <= east);
 
+    if (rows && rowWest < west) {
+        // The scan ended with a horizontal step on a row pair it didn't leave yet
+        drawOvalRow(fb, north, strokeColor, dc0 != 0, fillColor, rowWest, west - 1, east + 1, rowEast);
+        if (south != north) {
+            drawOvalRow(fb, south, strokeColor, dc0 != 0, fillColor, rowWest, west - 1, east + 1, rowEast);
+        }
+    }
+
     // Make sure north and south have moved the entire way so top/bottom aren't missing
     while (north - south < height) {
-        drawPointUnclipped(strokeColor, west - 1, north); /*   II. Quadrant    */
-        drawPointUnclipped(strokeColor, east + 1, north); /*   I. Quadrant     */
+        drawPointUnclipped(fb, strokeColor, west - 1, north); /*   II. Quadrant    */
+        drawPointUnclipped(fb, strokeColor, east + 1, north); /*   I. Quadrant     */
         north += 1;
-        drawPointUnclipped(strokeColor, west - 1, south); /*   III. Quadrant   */
-        drawPointUnclipped(strokeColor, east + 1, south); /*   IV. Quadrant    */
+        drawPointUnclipped(fb, strokeColor, west - 1, south); /*   III. Quadrant   */
+        drawPointUnclipped(fb, strokeColor, east + 1, south); /*   IV. Quadrant    */
         south -= 1;
     }
 }
 
-void w4_framebufferLine (int x1, int y1, int x2, int y2) {
-    uint8_t dc0 = drawColors[0] & 0xf;
+void w4_framebufferLine (w4_Framebuffer* fb, int x1, int y1, int x2, int y2) {
+    uint8_t dc0 = fb->drawColors[0] & 0xf;
     if (dc0 == 0) {
         return;
     }
@@ -483,7 +597,7 @@ void w4_framebufferLine (int x1, int y1, int x2, int y2) {
     int err = (dx > dy ? dx : -dy) / 2, e2;
 
     for (;;) {
-        drawPointUnclipped(strokeColor, x1, y1);
+        drawPointUnclipped(fb, strokeColor, x1, y1);
         if (x1 == x2 && y1 == y2) {
             break;
         }
@@ -499,50 +613,108 @@ void w4_framebufferLine (int x1, int y1, int x2, int y2) {
     }
 }
 
-void w4_framebufferText (const uint8_t* str, int x, int y) {
+static void refreshGlyphCache (w4_Framebuffer* fb) {
+    if (fb->drawColors[0] != fb->glyphCacheColors) {
+        fb->glyphCacheColors = fb->drawColors[0];
+        memset(fb->glyphCached, 0, sizeof(fb->glyphCached));
+    }
+}
+
+static const w4_GlyphRow* cachedGlyph (w4_Framebuffer* fb, int glyph) {
+    w4_GlyphRow* rows = fb->glyphCache[glyph];
+    if (!(fb->glyphCached[glyph >> 3] & (1 << (glyph & 7)))) {
+        uint8_t dc0 = fb->glyphCacheColors & 0x0f;
+        uint8_t dc1 = (fb->glyphCacheColors >> 4) & 0x0f;
+        uint16_t fill0 = ((dc0 - 1) & 0x03) * 0x5555;
+        uint16_t fill1 = ((dc1 - 1) & 0x03) * 0x5555;
+        for (int row = 0; row < 8; ++row) {
+            uint16_t is1 = spread1bpp[font[(glyph << 3) + row]] * 3;
+            uint16_t is0 = ~is1;
+            rows[row].mask = (dc0 != 0 ? is0 : 0) | (dc1 != 0 ? is1 : 0);
+            rows[row].color = ((is0 & fill0) | (is1 & fill1)) & rows[row].mask;
+        }
+        fb->glyphCached[glyph >> 3] |= 1 << (glyph & 7);
+    }
+    return rows;
+}
+
+static void drawGlyph (w4_Framebuffer* fb, int c, int x, int y) {
+    int glyph = c - 32;
+    if (glyph < 0 || glyph >= (int)FONT_GLYPHS || x < 0 || x > WIDTH - 8 || y < 0 || y > HEIGHT - 8) {
+        // Clipped or outside of the font, leave it to the blitter
+        w4_framebufferBlit(fb, font, x, y, 8, 8, 0, glyph * 8, 8, false, false, false, false);
+        return;
+    }
+
+    const w4_GlyphRow* rows = cachedGlyph(fb, glyph);
+    uint8_t* dst = fb->framebuffer + ((WIDTH * y + x) >> 2);
+    int shift = (x & 0x3) << 1;
+
+    if (shift == 0) {
+        // Byte aligned, each glyph row is exactly two framebuffer bytes
+        for (int row = 0; row < 8; ++row, dst += WIDTH >> 2) {
+            uint16_t color = rows[row].color;
+            uint16_t mask = rows[row].mask;
+            dst[0] = (dst[0] & ~mask) | color;
+            dst[1] = (dst[1] & ~(mask >> 8)) | (color >> 8);
+        }
+    } else {
+        for (int row = 0; row < 8; ++row, dst += WIDTH >> 2) {
+            uint32_t color = (uint32_t)rows[row].color << shift;
+            uint32_t mask = (uint32_t)rows[row].mask << shift;
+            dst[0] = (dst[0] & ~mask) | color;
+            dst[1] = (dst[1] & ~(mask >> 8)) | (color >> 8);
+            dst[2] = (dst[2] & ~(mask >> 16)) | (color >> 16);
+        }
+    }
+}
+
+void w4_framebufferText (w4_Framebuffer* fb, const uint8_t* str, int x, int y) {
+    refreshGlyphCache(fb);
     for (int currentX = x; *str != '\0'; ++str) {
         if (*str == 10) {
             y += 8;
             currentX = x;
         } else {
-            w4_framebufferBlit(font, currentX, y, 8, 8, 0, (*str - 32) << 3, 8,
-                false, false, false, false);
+            drawGlyph(fb, *str, currentX, y);
             currentX += 8;
         }
     }
 }
 
-void w4_framebufferTextUtf8 (const uint8_t* str, int byteLength, int x, int y) {
+void w4_framebufferTextUtf8 (w4_Framebuffer* fb, const uint8_t* str, int byteLength, int x, int y) {
+    refreshGlyphCache(fb);
     for (int currentX = x; byteLength > 0; ++str, --byteLength) {
         if (*str == 10) {
             y += 8;
             currentX = x;
         } else {
-            w4_framebufferBlit(font, currentX, y, 8, 8, 0, (*str - 32) << 3, 8,
-                false, false, false, false);
+            drawGlyph(fb, *str, currentX, y);
             currentX += 8;
         }
     }
 }
 
-void w4_framebufferTextUtf16 (const uint16_t* str, int byteLength, int x, int y) {
+void w4_framebufferTextUtf16 (w4_Framebuffer* fb, const uint16_t* str, int byteLength, int x, int y) {
+    refreshGlyphCache(fb);
     for (int currentX = x; byteLength > 0; ++str, byteLength -= 2) {
         uint16_t c = w4_read16LE(str);
         if (c == 10) {
             y += 8;
             currentX = x;
         } else {
-            w4_framebufferBlit(font, currentX, y, 8, 8, 0, (c - 32) << 3, 8,
-                false, false, false, false);
+            drawGlyph(fb, c, currentX, y);
             currentX += 8;
         }
     }
 }
 
-void w4_framebufferBlit (const uint8_t* sprite, int dstX, int dstY, int width, int height,
+// Generic per-pixel blit. Always inlined with constant flags into the kernels below, so the
+// compiler can drop the flag checks from the inner loop.
+W4_INLINE void blitGeneric (w4_Framebuffer* fb, const uint8_t* sprite, int dstX, int dstY, int width, int height,
     int srcX, int srcY, int srcStride, bool bpp2, bool flipX, bool flipY, bool rotate) {
 
-    uint16_t colors = drawColors[0] | (drawColors[1] << 8);
+    uint16_t colors = fb->drawColors[0] | (fb->drawColors[1] << 8);
 
     // Clip rectangle to screen
     int clipXMin, clipYMin, clipXMax, clipYMax;
@@ -587,8 +759,161 @@ void w4_framebufferBlit (const uint8_t* sprite, int dstX, int dstY, int width, i
             // Get the final color using the drawColors indirection
             uint8_t dc = (colors >> (colorIdx << 2)) & 0x0f;
             if (dc != 0) {
-                drawPoint((dc - 1) & 0x03, tx, ty);
+                drawPoint(fb, (dc - 1) & 0x03, tx, ty);
+            }
+        }
+    }
+}
+
+// Reverses the order of the four pixels in a 2bpp sprite byte, so the leftmost pixel lands in the
+// lowest bit pair like it does in the framebuffer.
+static uint8_t reverse2bpp (uint8_t byte) {
+    byte = ((byte & 0x33) << 2) | ((byte >> 2) & 0x33);
+    return (byte << 4) | (byte >> 4);
+}
+
+// Fast path for sprites that are neither flipped nor rotated. Source pixels are decoded a whole
+// byte at a time and written four at a time, one framebuffer byte per write. Transparent colors
+// are left out of the write mask. The output is identical to the generic per-pixel loop.
+static void blitSpans (w4_Framebuffer* fb, const uint8_t* sprite, int dstX, int dstY, int width, int height,
+    int srcX, int srcY, int srcStride, bool bpp2) {
+
+    int clipXMin = w4_max(0, dstX) - dstX;
+    int clipYMin = w4_max(0, dstY) - dstY;
+    int clipXMax = w4_min(width, WIDTH - dstX);
+    int clipYMax = w4_min(height, HEIGHT - dstY);
+    if (clipXMin >= clipXMax || clipYMin >= clipYMax) {
+        return;
+    }
+
+    // Whole source bytes are read ahead of the writes, so a sprite that overlaps the framebuffer
+    // (a cart copying part of the screen) has to go through the generic path
+    int firstRow = (srcY + clipYMin) * srcStride;
+    int lastRow = (srcY + clipYMax - 1) * srcStride;
+    int shift = bpp2 ? 2 : 3;
+    uintptr_t srcStart = (uintptr_t)sprite + ((w4_min(firstRow, lastRow) + srcX + clipXMin) >> shift);
+    uintptr_t srcEnd = (uintptr_t)sprite + ((w4_max(firstRow, lastRow) + srcX + clipXMax - 1) >> shift);
+    if (srcStart < (uintptr_t)fb->framebuffer + (WIDTH*HEIGHT >> 2) && srcEnd >= (uintptr_t)fb->framebuffer) {
+        blitGeneric(fb, sprite, dstX, dstY, width, height, srcX, srcY, srcStride, bpp2, false, false, false);
+        return;
+    }
+
+    // Per color index: the color repeated in every pixel, and whether it's drawn at all
+    uint32_t fill[4], opaque[4];
+    uint16_t colors = fb->drawColors[0] | (fb->drawColors[1] << 8);
+    for (int n = 0; n < 4; ++n) {
+        uint8_t dc = (colors >> (n << 2)) & 0x0f;
+        fill[n] = ((dc - 1) & 0x03) * 0x55555555u;
+        opaque[n] = dc != 0 ? 0xffffffffu : 0;
+    }
+
+    const int startX = dstX + clipXMin;
+    const int length = clipXMax - clipXMin;
+
+    for (int y = clipYMin; y < clipYMax; y++) {
+        uint8_t* dst = fb->framebuffer + ((WIDTH * (dstY + y) + startX) >> 2);
+        int bitIndex = (srcY + y) * srcStride + srcX + clipXMin;
+
+        // Decoded pixels waiting to be written, the first framebuffer byte may be partial
+        uint32_t pendingColor = 0;
+        uint32_t pendingMask = 0;
+        int pending = startX & 0x03;
+
+        for (int remaining = length; remaining > 0;) {
+            int taken;
+            uint32_t color, mask;
+            if (bpp2) {
+                int offset = bitIndex & 0x03;
+                taken = w4_min(4 - offset, remaining);
+                uint32_t valid = (1u << (taken << 1)) - 1;
+                uint32_t pixels = reverse2bpp(sprite[bitIndex >> 2]) >> (offset << 1);
+                uint32_t lo = pixels & valid & 0x55;
+                uint32_t hi = (pixels >> 1) & valid & 0x55;
+                uint32_t is0 = (valid & 0x55 & ~(lo | hi)) * 3;
+                uint32_t is1 = (lo & ~hi) * 3;
+                uint32_t is2 = (hi & ~lo) * 3;
+                uint32_t is3 = (lo & hi) * 3;
+                color = (is0 & fill[0]) | (is1 & fill[1]) | (is2 & fill[2]) | (is3 & fill[3]);
+                mask = (is0 & opaque[0]) | (is1 & opaque[1]) | (is2 & opaque[2]) | (is3 & opaque[3]);
+            } else {
+                int offset = bitIndex & 0x07;
+                taken = w4_min(8 - offset, remaining);
+                uint32_t valid = (1u << (taken << 1)) - 1;
+                uint32_t is1 = (spread1bpp[sprite[bitIndex >> 3]] >> (offset << 1)) * 3 & valid;
+                uint32_t is0 = valid & ~is1;
+                color = (is0 & fill[0]) | (is1 & fill[1]);
+                mask = (is0 & opaque[0]) | (is1 & opaque[1]);
             }
+
+            pendingColor |= color << (pending << 1);
+            pendingMask |= mask << (pending << 1);
+            pending += taken;
+            bitIndex += taken;
+            remaining -= taken;
+
+            for (; pending >= 4; pending -= 4) {
+                uint8_t byteMask = pendingMask;
+                *dst = (*dst & ~byteMask) | (pendingColor & byteMask);
+                ++dst;
+                pendingColor >>= 8;
+                pendingMask >>= 8;
+            }
+        }
+
+        if (pending > 0) {
+            uint8_t byteMask = pendingMask;
+            *dst = (*dst & ~byteMask) | (pendingColor & byteMask);
         }
     }
 }
+
+#define BLIT_KERNEL(flags) \
+    static void blitKernel##flags (w4_Framebuffer* fb, const uint8_t* sprite, int dstX, int dstY, \
+        int width, int height, int srcX, int srcY, int srcStride) { \
+        blitGeneric(fb, sprite, dstX, dstY, width, height, srcX, srcY, srcStride, (flags) & W4_BLIT_2BPP, \
+            (flags) & W4_BLIT_FLIP_X, (flags) & W4_BLIT_FLIP_Y, (flags) & W4_BLIT_ROTATE); \
+    }
+
+static void blitKernel0 (w4_Framebuffer* fb, const uint8_t* sprite, int dstX, int dstY, int width,
+    int height, int srcX, int srcY, int srcStride) {
+    blitSpans(fb, sprite, dstX, dstY, width, height, srcX, srcY, srcStride, false);
+}
+
+static void blitKernel1 (w4_Framebuffer* fb, const uint8_t* sprite, int dstX, int dstY, int width,
+    int height, int srcX, int srcY, int srcStride) {
+    blitSpans(fb, sprite, dstX, dstY, width, height, srcX, srcY, srcStride, true);
+}
+
+BLIT_KERNEL(2)
+BLIT_KERNEL(3)
+BLIT_KERNEL(4)
+BLIT_KERNEL(5)
+BLIT_KERNEL(6)
+BLIT_KERNEL(7)
+BLIT_KERNEL(8)
+BLIT_KERNEL(9)
+BLIT_KERNEL(10)
+BLIT_KERNEL(11)
+BLIT_KERNEL(12)
+BLIT_KERNEL(13)
+BLIT_KERNEL(14)
+BLIT_KERNEL(15)
+
+static const w4_BlitKernel blitKernels[16] = {
+    blitKernel0, blitKernel1, blitKernel2, blitKernel3,
+    blitKernel4, blitKernel5, blitKernel6, blitKernel7,
+    blitKernel8, blitKernel9, blitKernel10, blitKernel11,
+    blitKernel12, blitKernel13, blitKernel14, blitKernel15,
+};
+
+w4_BlitKernel w4_framebufferBlitKernel (int flags) {
+    return blitKernels[flags & 0xf];
+}
+
+void w4_framebufferBlit (w4_Framebuffer* fb, const uint8_t* sprite, int dstX, int dstY, int width, int height,
+    int srcX, int srcY, int srcStride, bool bpp2, bool flipX, bool flipY, bool rotate) {
+
+    int flags = (bpp2 ? W4_BLIT_2BPP : 0) | (flipX ? W4_BLIT_FLIP_X : 0)
+        | (flipY ? W4_BLIT_FLIP_Y : 0) | (rotate ? W4_BLIT_ROTATE : 0);
+    blitKernels[flags](fb, sprite, dstX, dstY, width, height, srcX, srcY, srcStride);
+}
@@ -6,23 +6,70 @@
 #define WIDTH 160
 #define HEIGHT 160
 
-void w4_framebufferInit (const uint8_t* drawColors, uint8_t* framebuffer);
+#define W4_BLIT_2BPP 1
+#define W4_BLIT_FLIP_X 2
+#define W4_BLIT_FLIP_Y 4
+#define W4_BLIT_ROTATE 8
 
-void w4_framebufferClear ();
+// Glyphs in the built-in font, starting at ' '
+#define W4_FONT_GLYPHS 224
 
-void w4_framebufferHLine (int x, int y, int length);
+// One font row expanded to 2bpp for the current drawColors pair, covering two framebuffer bytes
+typedef struct {
+    uint16_t color;
+    uint16_t mask;
+} w4_GlyphRow;
 
-void w4_framebufferVLine (int x, int y, int length);
+// Drawing state of one instance, pointing into its wasm memory
+typedef struct w4_Framebuffer {
+    const uint8_t* drawColors;
+    uint8_t* framebuffer;
 
-void w4_framebufferRect (int x, int y, int width, int height);
+    // Copy of the framebuffer as of the last w4_framebufferTakeDirtyRows(). Carts are free to store
+    // into framebuffer memory directly, so rows are compared by content rather than tracked per call.
+    uint8_t composited[WIDTH*HEIGHT >> 2];
+    // Rows that have to be handed out as dirty next time even when their content didn't change
+    uint8_t forcedRows[HEIGHT];
 
-void w4_framebufferLine (int x1, int y1, int x2, int y2);
+    // Glyphs are expanded on first use and dropped whenever drawColors[0] changes
+    w4_GlyphRow glyphCache[W4_FONT_GLYPHS][8];
+    uint8_t glyphCached[(W4_FONT_GLYPHS + 7) >> 3];
+    uint8_t glyphCacheColors;
+} w4_Framebuffer;
 
-void w4_framebufferOval (int x, int y, int width, int height);
+typedef void (*w4_BlitKernel) (w4_Framebuffer* fb, const uint8_t* sprite, int dstX, int dstY,
+    int width, int height, int srcX, int srcY, int srcStride);
 
-void w4_framebufferText (const uint8_t* str, int x, int y);
-void w4_framebufferTextUtf8 (const uint8_t* str, int byteLength, int x, int y);
-void w4_framebufferTextUtf16 (const uint16_t* str, int byteLength, int x, int y);
+void w4_framebufferInit (w4_Framebuffer* fb, const uint8_t* drawColors, uint8_t* framebuffer);
 
-void w4_framebufferBlit (const uint8_t* sprite, int dstX, int dstY, int width, int height,
-    int srcX, int srcY, int srcStride, bool bpp2, bool flipX, bool flipY, bool rotate);
+void w4_framebufferClear (w4_Framebuffer* fb);
+
+// Forces rows [startY, endY) to be reported dirty by the next w4_framebufferTakeDirtyRows(), for
+// when the composited output is gone (palette change, the frontend drew over it)
+void w4_framebufferMarkDirty (w4_Framebuffer* fb, int startY, int endY);
+
+// Sets dirtyRows[y] (HEIGHT entries) for every row that changed since the previous call or was
+// marked dirty, returns how many there are. A cart that clears and redraws the same picture every
+// frame ends up with no dirty rows.
+int w4_framebufferTakeDirtyRows (w4_Framebuffer* fb, uint8_t* dirtyRows);
+
+void w4_framebufferHLine (w4_Framebuffer* fb, int x, int y, int length);
+
+void w4_framebufferVLine (w4_Framebuffer* fb, int x, int y, int length);
+
+void w4_framebufferRect (w4_Framebuffer* fb, int x, int y, int width, int height);
+
+void w4_framebufferLine (w4_Framebuffer* fb, int x1, int y1, int x2, int y2);
+
+void w4_framebufferOval (w4_Framebuffer* fb, int x, int y, int width, int height);
+
+void w4_framebufferText (w4_Framebuffer* fb, const uint8_t* str, int x, int y);
+void w4_framebufferTextUtf8 (w4_Framebuffer* fb, const uint8_t* str, int byteLength, int x, int y);
+void w4_framebufferTextUtf16 (w4_Framebuffer* fb, const uint16_t* str, int byteLength, int x, int y);
+
+void w4_framebufferBlit (w4_Framebuffer* fb, const uint8_t* sprite, int dstX, int dstY, int width,
+    int height, int srcX, int srcY, int srcStride, bool bpp2, bool flipX, bool flipY, bool rotate);
+
+// Returns the blit specialised for a combination of W4_BLIT_* flags. Picking the kernel once per
+// call keeps the flag checks out of the per-pixel loop.
+w4_BlitKernel w4_framebufferBlitKernel (int flags);
@@ -0,0 +1,80 @@
+#include "loopback.h"
+
+#include <string.h>
+
+// Packets in flight per direction, a power of two
+#define QUEUE_SIZE 64
+
+typedef struct {
+    uint32_t sent;
+    int size;
+    uint8_t data[W4_NETPLAY_MAX_PACKET];
+} Packet;
+
+// Packets travelling to one side
+typedef struct {
+    Packet packets[QUEUE_SIZE];
+    unsigned head;
+    unsigned tail;
+} Queue;
+
+static Queue queues[2];
+static uint32_t now;
+static int latency;
+static int lossPercent;
+// Deterministic, so a lossy run can be repeated
+static uint32_t lossSeed;
+
+void w4_loopbackInit (int latency_, int lossPercent_) {
+    memset(queues, 0, sizeof(queues));
+    now = 0;
+    latency = latency_ > 0 ? latency_ : 0;
+    lossPercent = lossPercent_;
+    lossSeed = 0x12345678;
+}
+
+static bool lost () {
+    lossSeed ^= lossSeed << 13;
+    lossSeed ^= lossSeed >> 17;
+    lossSeed ^= lossSeed << 5;
+    return (int)(lossSeed % 100) < lossPercent;
+}
+
+static bool send (void* context, const uint8_t* data, int size) {
+    // Sent from one side, queued for the other
+    Queue* queue = &queues[!(intptr_t)context];
+    if (queue->head - queue->tail == QUEUE_SIZE || size > W4_NETPLAY_MAX_PACKET) {
+        return false;
+    }
+    if (lost()) {
+        return true;
+    }
+    Packet* packet = &queue->packets[queue->head++ & (QUEUE_SIZE - 1)];
+    packet->sent = now;
+    packet->size = size;
+    memcpy(packet->data, data, size);
+    return true;
+}
+
+static int receive (void* context, uint8_t* data, int capacity) {
+    Queue* queue = &queues[(intptr_t)context];
+    if (queue->tail == queue->head) {
+        return 0;
+    }
+    Packet* packet = &queue->packets[queue->tail & (QUEUE_SIZE - 1)];
+    if (now - packet->sent < (uint32_t)latency || packet->size > capacity) {
+        return 0;
+    }
+    ++queue->tail;
+    memcpy(data, packet->data, packet->size);
+    return packet->size;
+}
+
+w4_NetTransport w4_loopbackTransport (int side) {
+    w4_NetTransport transport = {send, receive, (void*)(intptr_t)(side & 1)};
+    return transport;
+}
+
+void w4_loopbackTick () {
+    ++now;
+}
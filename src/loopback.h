@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "netplay.h"
+
+// Two netplay transports connected to each other in the same process, for testing netplay without
+// a network. Packets are held back for a number of ticks, and some can be dropped on purpose.
+
+// Empties both directions. Packets take latency ticks to arrive, and lossPercent of them are lost.
+void w4_loopbackInit (int latency, int lossPercent);
+
+// One end of the connection, side 0 or 1
+w4_NetTransport w4_loopbackTransport (int side);
+
+// Advances the clock packets are delayed by, typically once per frame
+void w4_loopbackTick ();
@@ -0,0 +1,253 @@
+#include "netplay.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "profile.h"
+#include "runtime.h"
+
+#define HEADER_SIZE 13
+
+// Inputs kept per side, a power of two. Enough for the frames in flight on both sides, see the
+// stall condition in w4_netplayUpdate().
+#define INPUT_FRAMES 64
+
+static bool active;
+static w4_Runtime* runtime;
+static w4_NetTransport transport;
+static int localPlayer;
+
+// Frames simulated so far, and how many of them ran with the real remote input
+static int frame;
+static int confirmedFrame;
+
+// Local input is known up to localFrames, inputDelay frames ahead of frame. The remote side
+// acknowledged receiving it up to peerAck.
+static uint8_t localInputs[INPUT_FRAMES];
+static int localFrames;
+static int peerAck;
+
+// Remote input received so far, always the frames before remoteFrames
+static uint8_t remoteInputs[INPUT_FRAMES];
+static int remoteFrames;
+
+// The remote input each frame ran with, to find out which predictions were wrong
+static uint8_t usedInputs[INPUT_FRAMES];
+
+// The state before each frame that ran with a predicted input, by frame
+static uint8_t* snapshots;
+static int snapshotSize;
+
+static w4_NetplayStats stats;
+
+static void put32 (uint8_t* dst, uint32_t value) {
+    dst[0] = value;
+    dst[1] = value >> 8;
+    dst[2] = value >> 16;
+    dst[3] = value >> 24;
+}
+
+static uint32_t get32 (const uint8_t* src) {
+    return src[0] | (src[1] << 8) | (src[2] << 16) | ((uint32_t)src[3] << 24);
+}
+
+int w4_netplayEncode (uint8_t* packet, uint32_t ack, uint32_t start, const uint8_t* inputs, int count) {
+    if (count > W4_NETPLAY_MAX_PACKET - HEADER_SIZE) {
+        count = W4_NETPLAY_MAX_PACKET - HEADER_SIZE;
+    }
+    memcpy(packet, "W4NP", 4);
+    put32(packet + 4, ack);
+    put32(packet + 8, start);
+    packet[12] = count;
+    memcpy(packet + HEADER_SIZE, inputs, count);
+    return HEADER_SIZE + count;
+}
+
+bool w4_netplayDecode (const uint8_t* packet, int size, uint32_t* ack, uint32_t* start,
+    uint8_t* inputs, int* count) {
+    if (size < HEADER_SIZE || memcmp(packet, "W4NP", 4) != 0 || HEADER_SIZE + packet[12] != size) {
+        return false;
+    }
+    *ack = get32(packet + 4);
+    *start = get32(packet + 8);
+    *count = packet[12];
+    memcpy(inputs, packet + HEADER_SIZE, *count);
+    return true;
+}
+
+bool w4_netplayStart (w4_Runtime* runtime_, w4_NetTransport transport_, int localPlayer_, int inputDelay) {
+    w4_netplayStop();
+
+    snapshotSize = w4_runtimeSerializeSize();
+    snapshots = malloc(W4_NETPLAY_MAX_ROLLBACK * snapshotSize);
+    if (snapshots == NULL) {
+        return false;
+    }
+    if (inputDelay < 0) {
+        inputDelay = 0;
+    } else if (inputDelay > W4_NETPLAY_MAX_ROLLBACK) {
+        inputDelay = W4_NETPLAY_MAX_ROLLBACK;
+    }
+
+    active = true;
+    runtime = runtime_;
+    transport = transport_;
+    localPlayer = localPlayer_ & 1;
+    frame = 0;
+    confirmedFrame = 0;
+    // The delayed frames at the start have no input
+    memset(localInputs, 0, sizeof(localInputs));
+    localFrames = inputDelay;
+    peerAck = 0;
+    remoteFrames = 0;
+    memset(&stats, 0, sizeof(stats));
+    return true;
+}
+
+void w4_netplayStop () {
+    free(snapshots);
+    snapshots = NULL;
+    active = false;
+}
+
+bool w4_netplayActive () {
+    return active;
+}
+
+static uint8_t* snapshotOf (int frame_) {
+    return snapshots + (frame_ % W4_NETPLAY_MAX_ROLLBACK) * snapshotSize;
+}
+
+static void receive () {
+    uint8_t packet[W4_NETPLAY_MAX_PACKET];
+    uint8_t inputs[W4_NETPLAY_MAX_PACKET];
+    int size;
+    while ((size = transport.receive(transport.context, packet, sizeof(packet))) > 0) {
+        uint32_t ack, start;
+        int count;
+        if (!w4_netplayDecode(packet, size, &ack, &start, inputs, &count)) {
+            continue;
+        }
+        // Packets can arrive out of order, only ever move forward
+        if ((int)ack > peerAck && (int)ack <= localFrames) {
+            peerAck = ack;
+        }
+        for (int n = 0; n < count; ++n) {
+            int inputFrame = (int)(start + n);
+            if (inputFrame == remoteFrames && remoteFrames < confirmedFrame + INPUT_FRAMES) {
+                remoteInputs[remoteFrames % INPUT_FRAMES] = inputs[n];
+                ++remoteFrames;
+            }
+        }
+    }
+}
+
+// Sends every local input the remote side didn't acknowledge yet, so a lost packet only delays
+// input until the next one gets through
+static void send () {
+    uint8_t inputs[INPUT_FRAMES];
+    int count = localFrames - peerAck;
+    for (int n = 0; n < count; ++n) {
+        inputs[n] = localInputs[(peerAck + n) % INPUT_FRAMES];
+    }
+    uint8_t packet[W4_NETPLAY_MAX_PACKET];
+    int size = w4_netplayEncode(packet, remoteFrames, peerAck, inputs, count);
+    transport.send(transport.context, packet, size);
+}
+
+static void simulate () {
+    uint8_t remote;
+    if (frame < remoteFrames) {
+        remote = remoteInputs[frame % INPUT_FRAMES];
+    } else {
+        // Predicted, keep what is needed to undo the frame
+        uint32_t start = w4_profileNowUs();
+        w4_runtimeSerialize(runtime, snapshotOf(frame));
+        stats.snapshotUs += w4_profileNowUs() - start;
+        ++stats.snapshots;
+        remote = remoteFrames > 0 ? remoteInputs[(remoteFrames - 1) % INPUT_FRAMES] : 0;
+    }
+    usedInputs[frame % INPUT_FRAMES] = remote;
+
+    w4_runtimeSetGamepad(runtime, localPlayer, localInputs[frame % INPUT_FRAMES]);
+    w4_runtimeSetGamepad(runtime, localPlayer ^ 1, remote);
+    w4_runtimeUpdate(runtime);
+    ++frame;
+}
+
+// Checks the predictions of the frames the remote input arrived for, and simulates them again from
+// the first wrong one
+static void rollback () {
+    int end = remoteFrames < frame ? remoteFrames : frame;
+    int first = confirmedFrame;
+    while (first < end && usedInputs[first % INPUT_FRAMES] == remoteInputs[first % INPUT_FRAMES]) {
+        ++first;
+    }
+
+    if (first < end) {
+        uint32_t start = w4_profileNowUs();
+        w4_runtimeUnserialize(runtime, snapshotOf(first));
+        stats.restoreUs += w4_profileNowUs() - start;
+        ++stats.restores;
+
+        int present = frame;
+        int length = present - first;
+        ++stats.rollbacks;
+        stats.resimulatedFrames += length;
+        if (length > stats.maxRollback) {
+            stats.maxRollback = length;
+        }
+
+        // The sounds of these frames were played already
+        bool muted = w4_runtimeMuted(runtime);
+        w4_runtimeSetMuted(runtime, true);
+        for (frame = first; frame < present;) {
+            simulate();
+        }
+        w4_runtimeSetMuted(runtime, muted);
+    }
+    confirmedFrame = end;
+}
+
+bool w4_netplayPoll () {
+    if (!active) {
+        return false;
+    }
+    receive();
+    rollback();
+    send();
+    return confirmedFrame == frame;
+}
+
+bool w4_netplayUpdate (uint8_t gamepad) {
+    if (!active) {
+        return false;
+    }
+    receive();
+    rollback();
+
+    // Don't get further ahead of the remote side than can be rolled back, or than the input rings
+    // can hold until the remote side acknowledged them
+    if (frame - remoteFrames >= W4_NETPLAY_MAX_ROLLBACK || localFrames - peerAck >= INPUT_FRAMES) {
+        send();
+        ++stats.stalls;
+        return false;
+    }
+
+    localInputs[localFrames % INPUT_FRAMES] = gamepad;
+    ++localFrames;
+    send();
+
+    simulate();
+    if (confirmedFrame == frame - 1 && confirmedFrame < remoteFrames) {
+        confirmedFrame = frame;
+    }
+    return true;
+}
+
+w4_NetplayStats w4_netplayStats () {
+    w4_NetplayStats current = stats;
+    current.frames = frame;
+    current.confirmedFrames = confirmedFrame;
+    return current;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "runtime.h"
+
+// Two player netplay with rollback. Each side runs the cart itself and only gamepads are sent.
+// When the remote input of a frame hasn't arrived yet it is predicted to be the same as the last
+// one that did, and once the real input turns out different the runtime is restored to the frame
+// before it and simulated up to the present again, with tones muted. Mouse input isn't synced.
+
+// Largest packet w4_netplayEncode() produces
+#define W4_NETPLAY_MAX_PACKET 96
+
+// How many frames may be simulated ahead of the last remote input, the rollback never goes back
+// further than this
+#define W4_NETPLAY_MAX_ROLLBACK 8
+
+// Unreliable datagrams: packets may be lost, but not split or merged
+typedef struct {
+    bool (*send) (void* context, const uint8_t* data, int size);
+    // Copies the next waiting packet into data and returns its size, or 0 if none is waiting
+    int (*receive) (void* context, uint8_t* data, int capacity);
+    void* context;
+} w4_NetTransport;
+
+typedef struct {
+    // Frames simulated, and how many of them ran with the real remote input
+    int frames;
+    int confirmedFrames;
+    // Calls to w4_netplayUpdate() that had to wait for the remote side
+    int stalls;
+    int rollbacks;
+    int resimulatedFrames;
+    int maxRollback;
+    int snapshots;
+    uint32_t snapshotUs;
+    int restores;
+    uint32_t restoreUs;
+} w4_NetplayStats;
+
+// Starts a session on runtime right after the cart was loaded, on both sides. localPlayer is 0 or 1, the
+// remote side plays the other one. Local input is applied inputDelay frames after it was given,
+// which hides that much latency without any rollback.
+bool w4_netplayStart (w4_Runtime* runtime, w4_NetTransport transport, int localPlayer, int inputDelay);
+
+void w4_netplayStop ();
+
+bool w4_netplayActive ();
+
+// Runs the next frame with the local gamepad, in place of w4_runtimeUpdate(). Rolls back first if
+// remote input arrived that was mispredicted. Returns false without running anything when the
+// remote side is too far behind, call it again later.
+bool w4_netplayUpdate (uint8_t gamepad);
+
+// Receives and sends input without running a frame, rolling back if needed. Returns true once
+// every frame that ran had the real remote input.
+bool w4_netplayPoll ();
+
+w4_NetplayStats w4_netplayStats ();
+
+// The packet format, for peers that only relay input: the first local frame the remote side still
+// needs (ack), followed by the inputs from frame start on
+int w4_netplayEncode (uint8_t* packet, uint32_t ack, uint32_t start, const uint8_t* inputs, int count);
+
+// Returns false if the packet is malformed, inputs has to hold W4_NETPLAY_MAX_PACKET bytes
+bool w4_netplayDecode (const uint8_t* packet, int size, uint32_t* ack, uint32_t* start,
+    uint8_t* inputs, int* count);
@@ -0,0 +1,98 @@
+#include "profile.h"
+
+#include <stdio.h>
+#include <string.h>
+
+typedef struct {
+    uint32_t calls;
+    uint32_t us;
+} Totals;
+
+static bool enabled;
+static uint32_t frameStart;
+static uint32_t frameCount;
+
+// Accumulated during the current frame, and the numbers of the last finished one
+static Totals current[W4_PROFILE_COUNT];
+static Totals finished[W4_PROFILE_COUNT];
+
+void w4_profileSetEnabled (bool enabled_) {
+    if (enabled_ && !enabled) {
+        memset(current, 0, sizeof(current));
+        memset(finished, 0, sizeof(finished));
+        frameStart = w4_profileNowUs();
+        frameCount = 0;
+    }
+    enabled = enabled_;
+}
+
+bool w4_profileEnabled () {
+    return enabled;
+}
+
+uint32_t w4_profileBegin () {
+    return enabled ? w4_profileNowUs() : 0;
+}
+
+void w4_profileEnd (w4_ProfileSection section, uint32_t start) {
+    if (enabled) {
+        ++current[section].calls;
+        current[section].us += w4_profileNowUs() - start;
+    }
+}
+
+void w4_profileEndFrame () {
+    if (!enabled) {
+        return;
+    }
+    uint32_t now = w4_profileNowUs();
+    current[W4_PROFILE_FRAME].calls = 1;
+    current[W4_PROFILE_FRAME].us = now - frameStart;
+    frameStart = now;
+    ++frameCount;
+
+    memcpy(finished, current, sizeof(finished));
+    memset(current, 0, sizeof(current));
+}
+
+const char* w4_profileName (w4_ProfileSection section) {
+    static const char* const names[W4_PROFILE_IMPORT] = {
+        "frame", "update", "clear", "composite", "audio",
+    };
+    if (section >= W4_PROFILE_IMPORT) {
+        return w4_wasmImportName(section - W4_PROFILE_IMPORT);
+    }
+    return names[section];
+}
+
+uint32_t w4_profileCalls (w4_ProfileSection section) {
+    return finished[section].calls;
+}
+
+uint32_t w4_profileUs (w4_ProfileSection section) {
+    return finished[section].us;
+}
+
+int w4_profileCsvHeader (char* dest, int size) {
+    int length = snprintf(dest, size, "frame_number");
+    for (int n = 0; n < W4_PROFILE_COUNT && length < size; ++n) {
+        const char* name = w4_profileName(n);
+        length += snprintf(dest + length, size - length, ",%s_calls,%s_us", name, name);
+    }
+    if (length < size) {
+        length += snprintf(dest + length, size - length, "\n");
+    }
+    return length < size ? length : size - 1;
+}
+
+int w4_profileCsvRow (char* dest, int size) {
+    int length = snprintf(dest, size, "%u", (unsigned)frameCount);
+    for (int n = 0; n < W4_PROFILE_COUNT && length < size; ++n) {
+        length += snprintf(dest + length, size - length, ",%u,%u",
+            (unsigned)finished[n].calls, (unsigned)finished[n].us);
+    }
+    if (length < size) {
+        length += snprintf(dest + length, size - length, "\n");
+    }
+    return length < size ? length : size - 1;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "wasm.h"
+
+// Call counts and time spent per frame in the parts of the emulator worth tuning: the cart's
+// update, the framebuffer clear, compositing, audio rendering and every import the cart calls.
+// Off by default, the instrumented code only pays for a branch then.
+
+typedef enum {
+    // Time between two w4_profileEndFrame() calls
+    W4_PROFILE_FRAME,
+    W4_PROFILE_UPDATE,
+    W4_PROFILE_CLEAR,
+    W4_PROFILE_COMPOSITE,
+    // Measured on the audio callback, counts can be off by one around the end of a frame
+    W4_PROFILE_AUDIO,
+    // One section per import, in w4_WasmImport order. Their time is part of W4_PROFILE_UPDATE.
+    W4_PROFILE_IMPORT,
+    W4_PROFILE_COUNT = W4_PROFILE_IMPORT + W4_IMPORT_COUNT,
+} w4_ProfileSection;
+
+// A microsecond clock, implemented by the frontend
+uint32_t w4_profileNowUs ();
+
+void w4_profileSetEnabled (bool enabled);
+bool w4_profileEnabled ();
+
+// Returns the start time to hand to w4_profileEnd(), which adds a call and the time since then to
+// section. Both do nothing while profiling is off.
+uint32_t w4_profileBegin ();
+void w4_profileEnd (w4_ProfileSection section, uint32_t start);
+
+// Finishes the current frame, the getters below return its numbers until the next call
+void w4_profileEndFrame ();
+
+const char* w4_profileName (w4_ProfileSection section);
+uint32_t w4_profileCalls (w4_ProfileSection section);
+uint32_t w4_profileUs (w4_ProfileSection section);
+
+// Formats the CSV header, or a row with the last finished frame, into dest with a trailing
+// newline. Returns the length, truncated to fit like snprintf().
+int w4_profileCsvHeader (char* dest, int size);
+int w4_profileCsvRow (char* dest, int size);
@@ -0,0 +1,307 @@
+#include "replay.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "framebuffer.h"
+#include "runtime.h"
+
+#define VERSION 1
+#define HEADER_SIZE 13
+
+// Each frame starts with a byte of these flags, followed by the parts that are set, in this order
+#define FRAME_GAMEPAD(idx) (1 << (idx))
+#define FRAME_MOUSE 0x10
+#define FRAME_HASH 0x20
+
+static w4_ReplayMode mode;
+static w4_Runtime* runtime;
+static int hashInterval;
+
+// Recording: a growing buffer. Playback: the caller's data.
+static uint8_t* buffer;
+static int capacity;
+static const uint8_t* data;
+static int size;
+static int pos;
+
+static int frame;
+static int mismatchFrame;
+static bool finished;
+
+// Input of the previous frame, only changes are stored. The first frame stores all of it.
+static uint8_t gamepads[4];
+static int16_t mouseX;
+static int16_t mouseY;
+static uint8_t mouseButtons;
+
+// Framebuffer hash expected at the end of the current frame
+static bool hashPending;
+static uint32_t expectedHash;
+
+uint32_t w4_replayHash (const uint8_t* bytes, int length) {
+    uint32_t hash = 2166136261u;
+    for (int n = 0; n < length; ++n) {
+        hash = (hash ^ bytes[n]) * 16777619u;
+    }
+    return hash;
+}
+
+static uint8_t* reserve (int length) {
+    if (size + length > capacity) {
+        int grown = capacity > 0 ? capacity * 2 : 4096;
+        while (grown < size + length) {
+            grown *= 2;
+        }
+        uint8_t* bigger = realloc(buffer, grown);
+        if (bigger == NULL) {
+            return NULL;
+        }
+        buffer = bigger;
+        capacity = grown;
+    }
+    uint8_t* dst = buffer + size;
+    size += length;
+    return dst;
+}
+
+static void put16 (uint8_t* dst, uint16_t value) {
+    dst[0] = value;
+    dst[1] = value >> 8;
+}
+
+static void put32 (uint8_t* dst, uint32_t value) {
+    put16(dst, value);
+    put16(dst + 2, value >> 16);
+}
+
+static uint16_t get16 (const uint8_t* src) {
+    return src[0] | (src[1] << 8);
+}
+
+static uint32_t get32 (const uint8_t* src) {
+    return get16(src) | ((uint32_t)get16(src + 2) << 16);
+}
+
+static void reset () {
+    frame = 0;
+    mismatchFrame = -1;
+    finished = false;
+    hashPending = false;
+}
+
+bool w4_replayStartRecording (w4_Runtime* runtime_, uint32_t cartHash, int hashInterval_) {
+    w4_replayStop();
+
+    // The disk is the only state a cart starts with besides its own bytes
+    uint8_t disk[1024];
+    int diskSize = w4_runtimeDiskr(runtime_, disk, sizeof(disk));
+
+    size = 0;
+    uint8_t* header = reserve(HEADER_SIZE + diskSize);
+    if (header == NULL) {
+        return false;
+    }
+    memcpy(header, "W4RP", 4);
+    header[4] = VERSION;
+    put16(header + 5, hashInterval_);
+    put32(header + 7, cartHash);
+    put16(header + 11, diskSize);
+    memcpy(header + HEADER_SIZE, disk, diskSize);
+
+    mode = W4_REPLAY_RECORDING;
+    runtime = runtime_;
+    hashInterval = hashInterval_;
+    reset();
+    return true;
+}
+
+bool w4_replayStartPlayback (w4_Runtime* runtime_, const uint8_t* data_, int size_, uint32_t cartHash) {
+    w4_replayStop();
+
+    if (size_ < HEADER_SIZE || memcmp(data_, "W4RP", 4) != 0 || data_[4] != VERSION
+            || get32(data_ + 7) != cartHash) {
+        return false;
+    }
+    int diskSize = get16(data_ + 11);
+    if (HEADER_SIZE + diskSize > size_) {
+        return false;
+    }
+    w4_runtimeDiskw(runtime_, data_ + HEADER_SIZE, diskSize);
+
+    mode = W4_REPLAY_PLAYING;
+    runtime = runtime_;
+    hashInterval = get16(data_ + 5);
+    data = data_;
+    size = size_;
+    pos = HEADER_SIZE + diskSize;
+    reset();
+    return true;
+}
+
+void w4_replayStop () {
+    free(buffer);
+    buffer = NULL;
+    capacity = 0;
+    mode = W4_REPLAY_OFF;
+    data = NULL;
+    size = 0;
+}
+
+w4_ReplayMode w4_replayMode () {
+    return mode;
+}
+
+static void recordFrame () {
+    uint8_t current[4];
+    int16_t x, y;
+    uint8_t buttons;
+    for (int n = 0; n < 4; ++n) {
+        current[n] = w4_runtimeGetGamepad(runtime, n);
+    }
+    w4_runtimeGetMouse(runtime, &x, &y, &buttons);
+
+    uint8_t flags = 0;
+    int length = 1;
+    for (int n = 0; n < 4; ++n) {
+        if (current[n] != gamepads[n] || frame == 0) {
+            flags |= FRAME_GAMEPAD(n);
+            ++length;
+        }
+    }
+    if (x != mouseX || y != mouseY || buttons != mouseButtons || frame == 0) {
+        flags |= FRAME_MOUSE;
+        length += 5;
+    }
+    if (hashInterval > 0 && (frame + 1) % hashInterval == 0) {
+        flags |= FRAME_HASH;
+        length += 4;
+    }
+
+    uint8_t* dst = reserve(length);
+    if (dst == NULL) {
+        // Out of memory, keep what was recorded so far
+        mode = W4_REPLAY_OFF;
+        return;
+    }
+    // Only once there is room for it, w4_replayEndFrame() would compare against nothing otherwise
+    hashPending = (flags & FRAME_HASH) != 0;
+    *dst++ = flags;
+    for (int n = 0; n < 4; ++n) {
+        if (flags & FRAME_GAMEPAD(n)) {
+            *dst++ = current[n];
+        }
+    }
+    if (flags & FRAME_MOUSE) {
+        put16(dst, x);
+        put16(dst + 2, y);
+        dst[4] = buttons;
+    }
+    // The hash is filled in by w4_replayEndFrame()
+
+    memcpy(gamepads, current, sizeof(gamepads));
+    mouseX = x;
+    mouseY = y;
+    mouseButtons = buttons;
+}
+
+static int frameLength (uint8_t flags) {
+    int length = 1;
+    for (int n = 0; n < 4; ++n) {
+        length += (flags & FRAME_GAMEPAD(n)) != 0;
+    }
+    length += (flags & FRAME_MOUSE) ? 5 : 0;
+    length += (flags & FRAME_HASH) ? 4 : 0;
+    return length;
+}
+
+static void playFrame () {
+    int length = pos < size ? frameLength(data[pos]) : 0;
+    if (length == 0 || pos + length > size) {
+        finished = true;
+        return;
+    }
+    uint8_t flags = data[pos];
+
+    const uint8_t* src = data + pos + 1;
+    pos += length;
+    for (int n = 0; n < 4; ++n) {
+        if (flags & FRAME_GAMEPAD(n)) {
+            gamepads[n] = *src++;
+        }
+    }
+    if (flags & FRAME_MOUSE) {
+        mouseX = get16(src);
+        mouseY = get16(src + 2);
+        mouseButtons = src[4];
+        src += 5;
+    }
+    hashPending = (flags & FRAME_HASH) != 0;
+    if (hashPending) {
+        expectedHash = get32(src);
+    }
+
+    for (int n = 0; n < 4; ++n) {
+        w4_runtimeSetGamepad(runtime, n, gamepads[n]);
+    }
+    w4_runtimeSetMouse(runtime, mouseX, mouseY, mouseButtons);
+}
+
+void w4_replayBeginFrame () {
+    if (mode == W4_REPLAY_RECORDING) {
+        recordFrame();
+    } else if (mode == W4_REPLAY_PLAYING && !finished) {
+        playFrame();
+    }
+}
+
+bool w4_replayEndFrame () {
+    bool matched = true;
+    if (hashPending) {
+        uint32_t hash = w4_replayHash(w4_runtimeGetFramebuffer(runtime), WIDTH*HEIGHT >> 2);
+        if (mode == W4_REPLAY_RECORDING) {
+            put32(buffer + size - 4, hash);
+        } else if (hash != expectedHash) {
+            matched = false;
+            if (mismatchFrame < 0) {
+                mismatchFrame = frame;
+            }
+        }
+        hashPending = false;
+    }
+    if (mode != W4_REPLAY_OFF && !finished) {
+        ++frame;
+    }
+    return matched;
+}
+
+bool w4_replayFinished () {
+    return finished;
+}
+
+int w4_replayFrame () {
+    return frame;
+}
+
+int w4_replayLength () {
+    if (mode != W4_REPLAY_PLAYING) {
+        return frame;
+    }
+    int frames = 0;
+    for (int n = HEADER_SIZE + get16(data + 11); n < size; ++frames) {
+        n += frameLength(data[n]);
+        if (n > size) {
+            break;
+        }
+    }
+    return frames;
+}
+
+int w4_replayMismatchFrame () {
+    return mismatchFrame;
+}
+
+const uint8_t* w4_replayData (int* size_) {
+    *size_ = size;
+    return mode == W4_REPLAY_PLAYING ? data : buffer;
+}
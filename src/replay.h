@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "runtime.h"
+
+// Input recording and playback. A recording holds the gamepad and mouse state of every frame,
+// stored only when it changed, plus a hash of the framebuffer every few frames so playback can tell
+// when a build renders differently. Reading and writing the files is left to the frontend.
+
+typedef enum {
+    W4_REPLAY_OFF,
+    W4_REPLAY_RECORDING,
+    W4_REPLAY_PLAYING,
+} w4_ReplayMode;
+
+// Hash of a byte range, used for the framebuffer checks and to identify the cart
+uint32_t w4_replayHash (const uint8_t* data, int size);
+
+// Starts recording runtime right after a cart was loaded, before its first update. The current disk
+// contents are stored so playback starts from the same state. hashInterval is in frames, 0 turns
+// the framebuffer checks off.
+bool w4_replayStartRecording (w4_Runtime* runtime, uint32_t cartHash, int hashInterval);
+
+// Starts playing a recording back, also right after the cart was loaded. Fails when the data isn't
+// a recording or was made with a different cart. data has to stay valid until playback stops.
+bool w4_replayStartPlayback (w4_Runtime* runtime, const uint8_t* data, int size, uint32_t cartHash);
+
+void w4_replayStop ();
+
+w4_ReplayMode w4_replayMode ();
+
+// Call before w4_runtimeUpdate(), after the frontend set its input. Records that input, or
+// replaces it with the recorded one during playback.
+void w4_replayBeginFrame ();
+
+// Call after w4_runtimeUpdate(). Records or checks the framebuffer hash, returns false when it
+// doesn't match the recording.
+bool w4_replayEndFrame ();
+
+// True once playback ran out of recorded frames
+bool w4_replayFinished ();
+
+// Frames recorded or played so far, and the first frame whose framebuffer didn't match (-1 if none)
+int w4_replayFrame ();
+int w4_replayMismatchFrame ();
+
+// Number of frames in the recording being played, or recorded so far
+int w4_replayLength ();
+
+// The recording made so far
+const uint8_t* w4_replayData (int* size);
@@ -1,9 +1,11 @@
 #include "runtime.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "framebuffer.h"
+#include "profile.h"
 #include "util.h"
 #include "wasm.h"
 #include "window.h"
@@ -27,144 +29,267 @@ typedef struct {
     uint8_t _user[58976];
 } Memory;
 
+struct w4_Runtime {
+    w4_Wasm* wasm;
+    Memory* memory;
+    w4_Framebuffer framebuffer;
+    w4_Disk* disk;
+    int diskWrites;
+    bool muted;
+    bool firstFrame;
+    uint32_t drawnPalette[4];
+    uint8_t dirtyRows[HEIGHT];
+
+    // One bit per W4_PAGE_SIZE bytes of memory written since the last serialize
+    uint8_t dirtyPages[W4_PAGE_COUNT >> 3];
+
+#ifdef W4_TRACK_WASM_STORES
+    // Memory as of the last scan, to find the pages the cart itself stored to
+    uint8_t shadow[W4_PAGE_COUNT * W4_PAGE_SIZE];
+#endif
+};
+
 typedef struct {
     Memory memory;
     w4_Disk disk;
     bool firstFrame;
 } SerializedState;
 
-static Memory* memory;
-static w4_Disk* disk;
-static bool firstFrame;
+static void markDirty (w4_Runtime* runtime, const void* ptr, int size) {
+    int offset = (const uint8_t*)ptr - (const uint8_t*)runtime->memory;
+    if (size <= 0 || offset < 0 || offset >= W4_PAGE_COUNT * W4_PAGE_SIZE) {
+        return;
+    }
+    int firstPage = offset / W4_PAGE_SIZE;
+    int lastPage = (offset + size - 1) / W4_PAGE_SIZE;
+    if (lastPage >= W4_PAGE_COUNT) {
+        lastPage = W4_PAGE_COUNT - 1;
+    }
+    for (int page = firstPage; page <= lastPage; ++page) {
+        runtime->dirtyPages[page >> 3] |= 1 << (page & 7);
+    }
+}
+
+static void markAllDirty (w4_Runtime* runtime) {
+    memset(runtime->dirtyPages, 0xff, sizeof(runtime->dirtyPages));
+#ifdef W4_TRACK_WASM_STORES
+    memcpy(runtime->shadow, runtime->memory, sizeof(runtime->shadow));
+#endif
+}
+
+static void markFramebuffer (w4_Runtime* runtime) {
+    markDirty(runtime, runtime->memory->framebuffer, sizeof(runtime->memory->framebuffer));
+}
+
+// Wasm code can store anywhere in memory, without W4_TRACK_WASM_STORES every page is assumed
+// written after it ran
+static void markWasmStores (w4_Runtime* runtime) {
+#ifdef W4_TRACK_WASM_STORES
+    const uint8_t* bytes = (const uint8_t*)runtime->memory;
+    for (int page = 0; page < W4_PAGE_COUNT; ++page) {
+        int offset = page * W4_PAGE_SIZE;
+        if (memcmp(bytes + offset, runtime->shadow + offset, W4_PAGE_SIZE) != 0) {
+            memcpy(runtime->shadow + offset, bytes + offset, W4_PAGE_SIZE);
+            runtime->dirtyPages[page >> 3] |= 1 << (page & 7);
+        }
+    }
+#else
+    memset(runtime->dirtyPages, 0xff, sizeof(runtime->dirtyPages));
+#endif
+}
 
-void w4_runtimeInit (uint8_t* memoryBytes, w4_Disk* diskBytes) {
-    memory = (Memory*)memoryBytes;
-    disk = diskBytes;
-    firstFrame = true;
+w4_Runtime* w4_runtimeCreate (w4_Disk* disk) {
+    w4_Runtime* runtime = calloc(1, sizeof(*runtime));
+    if (runtime == NULL) {
+        return NULL;
+    }
+    runtime->wasm = w4_wasmInit(runtime, &runtime->framebuffer);
+    if (runtime->wasm == NULL) {
+        free(runtime);
+        return NULL;
+    }
+    runtime->memory = (Memory*)w4_wasmMemory(runtime->wasm);
+    runtime->disk = disk;
+    runtime->firstFrame = true;
 
     // Set memory to initial state
-    memset(memory, 0, 1 << 16);
-    w4_write32LE(&memory->palette[0], 0xe0f8cf);
-    w4_write32LE(&memory->palette[1], 0x86c06c);
-    w4_write32LE(&memory->palette[2], 0x306850);
-    w4_write32LE(&memory->palette[3], 0x071821);
-    memory->drawColors[0] = 0x03;
-    memory->drawColors[1] = 0x12;
-    w4_write16LE(&memory->mouseX, 0x7fff);
-    w4_write16LE(&memory->mouseY, 0x7fff);
+    memset(runtime->memory, 0, 1 << 16);
+    w4_write32LE(&runtime->memory->palette[0], 0xe0f8cf);
+    w4_write32LE(&runtime->memory->palette[1], 0x86c06c);
+    w4_write32LE(&runtime->memory->palette[2], 0x306850);
+    w4_write32LE(&runtime->memory->palette[3], 0x071821);
+    runtime->memory->drawColors[0] = 0x03;
+    runtime->memory->drawColors[1] = 0x12;
+    w4_write16LE(&runtime->memory->mouseX, 0x7fff);
+    w4_write16LE(&runtime->memory->mouseY, 0x7fff);
+
+    w4_framebufferInit(&runtime->framebuffer, runtime->memory->drawColors, runtime->memory->framebuffer);
+    markAllDirty(runtime);
+    return runtime;
+}
 
-    w4_framebufferInit(&memory->drawColors, memory->framebuffer);
+void w4_runtimeDestroy (w4_Runtime* runtime) {
+    if (runtime != NULL) {
+        w4_wasmDestroy(runtime->wasm);
+        free(runtime);
+    }
+}
+
+w4_Wasm* w4_runtimeWasm (w4_Runtime* runtime) {
+    return runtime->wasm;
 }
 
-void w4_runtimeSetGamepad (int idx, uint8_t gamepad) {
-    memory->gamepads[idx] = gamepad;
+void w4_runtimeSetGamepad (w4_Runtime* runtime, int idx, uint8_t gamepad) {
+    runtime->memory->gamepads[idx] = gamepad;
+    markDirty(runtime, &runtime->memory->gamepads[idx], 1);
 }
 
-void w4_runtimeSetMouse (int16_t x, int16_t y, uint8_t buttons) {
-    w4_write16LE(&memory->mouseX, x);
-    w4_write16LE(&memory->mouseY, y);
-    memory->mouseButtons = buttons;
+void w4_runtimeSetMouse (w4_Runtime* runtime, int16_t x, int16_t y, uint8_t buttons) {
+    w4_write16LE(&runtime->memory->mouseX, x);
+    w4_write16LE(&runtime->memory->mouseY, y);
+    runtime->memory->mouseButtons = buttons;
+    markDirty(runtime, &runtime->memory->mouseX, (const uint8_t*)(&runtime->memory->mouseButtons + 1) - (const uint8_t*)&runtime->memory->mouseX);
 }
 
-void w4_runtimeBlit (const uint8_t* sprite, int x, int y, int width, int height, int flags) {
+uint8_t w4_runtimeGetGamepad (w4_Runtime* runtime, int idx) {
+    return runtime->memory->gamepads[idx];
+}
+
+void w4_runtimeGetMouse (w4_Runtime* runtime, int16_t* x, int16_t* y, uint8_t* buttons) {
+    *x = w4_read16LE((const uint16_t*)&runtime->memory->mouseX);
+    *y = w4_read16LE((const uint16_t*)&runtime->memory->mouseY);
+    *buttons = runtime->memory->mouseButtons;
+}
+
+const uint8_t* w4_runtimeGetFramebuffer (w4_Runtime* runtime) {
+    return runtime->memory->framebuffer;
+}
+
+void w4_runtimeBlit (w4_Runtime* runtime, const uint8_t* sprite, int x, int y, int width, int height, int flags) {
     // printf("blit: %p, %d, %d, %d, %d, %d\n", sprite, x, y, width, height, flags);
 
-    w4_runtimeBlitSub(sprite, x, y, width, height, 0, 0, width, flags);
+    w4_runtimeBlitSub(runtime, sprite, x, y, width, height, 0, 0, width, flags);
 }
 
-void w4_runtimeBlitSub (const uint8_t* sprite, int x, int y, int width, int height, int srcX, int srcY, int stride, int flags) {
+void w4_runtimeBlitSub (w4_Runtime* runtime, const uint8_t* sprite, int x, int y, int width, int height, int srcX, int srcY, int stride, int flags) {
     // printf("blitSub: %p, %d, %d, %d, %d, %d, %d, %d, %d\n", sprite, x, y, width, height, srcX, srcY, stride, flags);
 
-    bool bpp2 = (flags & 1);
-    bool flipX = (flags & 2);
-    bool flipY = (flags & 4);
-    bool rotate = (flags & 8);
-    w4_framebufferBlit(sprite, x, y, width, height, srcX, srcY, stride, bpp2, flipX, flipY, rotate);
+    w4_BlitKernel blit = w4_framebufferBlitKernel(flags);
+    blit(&runtime->framebuffer, sprite, x, y, width, height, srcX, srcY, stride);
+    markFramebuffer(runtime);
 }
 
-void w4_runtimeLine (int x1, int y1, int x2, int y2) {
+void w4_runtimeLine (w4_Runtime* runtime, int x1, int y1, int x2, int y2) {
     // printf("line: %d, %d, %d, %d\n", x1, y1, x2, y2);
-    w4_framebufferLine(x1, y1, x2, y2);
+    w4_framebufferLine(&runtime->framebuffer, x1, y1, x2, y2);
+    markFramebuffer(runtime);
 }
 
-void w4_runtimeHLine (int x, int y, int len) {
+void w4_runtimeHLine (w4_Runtime* runtime, int x, int y, int len) {
     // printf("hline: %d, %d, %d\n", x, y, len);
-    w4_framebufferHLine(x, y, len);
+    w4_framebufferHLine(&runtime->framebuffer, x, y, len);
+    markFramebuffer(runtime);
 }
 
-void w4_runtimeVLine (int x, int y, int len) {
+void w4_runtimeVLine (w4_Runtime* runtime, int x, int y, int len) {
     // printf("vline: %d, %d, %d\n", x, y, len);
-    w4_framebufferVLine(x, y, len);
+    w4_framebufferVLine(&runtime->framebuffer, x, y, len);
+    markFramebuffer(runtime);
 }
 
-void w4_runtimeOval (int x, int y, int width, int height) {
+void w4_runtimeOval (w4_Runtime* runtime, int x, int y, int width, int height) {
     // printf("oval: %d, %d, %d, %d\n", x, y, width, height);
-    w4_framebufferOval(x, y, width, height);
+    w4_framebufferOval(&runtime->framebuffer, x, y, width, height);
+    markFramebuffer(runtime);
 }
 
-void w4_runtimeRect (int x, int y, int width, int height) {
+void w4_runtimeRect (w4_Runtime* runtime, int x, int y, int width, int height) {
     // printf("rect: %d, %d, %d, %d\n", x, y, width, height);
-    w4_framebufferRect(x, y, width, height);
+    w4_framebufferRect(&runtime->framebuffer, x, y, width, height);
+    markFramebuffer(runtime);
 }
 
-void w4_runtimeText (const uint8_t* str, int x, int y) {
+void w4_runtimeText (w4_Runtime* runtime, const uint8_t* str, int x, int y) {
     // printf("text: %s, %d, %d\n", str, x, y);
-    w4_framebufferText(str, x, y);
+    w4_framebufferText(&runtime->framebuffer, str, x, y);
+    markFramebuffer(runtime);
 }
 
-void w4_runtimeTextUtf8 (const uint8_t* str, int byteLength, int x, int y) {
+void w4_runtimeTextUtf8 (w4_Runtime* runtime, const uint8_t* str, int byteLength, int x, int y) {
     // printf("textUtf8: %p, %d, %d, %d\n", str, byteLength, x, y);
-    w4_framebufferTextUtf8(str, byteLength, x, y);
+    w4_framebufferTextUtf8(&runtime->framebuffer, str, byteLength, x, y);
+    markFramebuffer(runtime);
 }
 
-void w4_runtimeTextUtf16 (const uint16_t* str, int byteLength, int x, int y) {
+void w4_runtimeTextUtf16 (w4_Runtime* runtime, const uint16_t* str, int byteLength, int x, int y) {
     // printf("textUtf16: %p, %d, %d, %d\n", str, byteLength, x, y);
-    w4_framebufferTextUtf16(str, byteLength, x, y);
+    w4_framebufferTextUtf16(&runtime->framebuffer, str, byteLength, x, y);
+    markFramebuffer(runtime);
 }
 void wasm4_tone_callback (int frequency, int duration, int volume, int flags);
-void w4_runtimeTone (int frequency, int duration, int volume, int flags) {
+void w4_runtimeTone (w4_Runtime* runtime, int frequency, int duration, int volume, int flags) {
     // printf("tone: %d, %d, %d, %d\n", frequency, duration, volume, flags);
-    wasm4_tone_callback(frequency, duration, volume, flags);
+    if (!runtime->muted) {
+        wasm4_tone_callback(frequency, duration, volume, flags);
+    }
+}
+
+void w4_runtimeSetMuted (w4_Runtime* runtime, bool muted) {
+    runtime->muted = muted;
 }
 
-int w4_runtimeDiskr (uint8_t* dest, int size) {
-    if (!disk) {
+bool w4_runtimeMuted (w4_Runtime* runtime) {
+    return runtime->muted;
+}
+
+int w4_runtimeDiskr (w4_Runtime* runtime, uint8_t* dest, int size) {
+    if (!runtime->disk) {
         return 0;
     }
 
-    if (size > disk->size) {
-        size = disk->size;
+    if (size > runtime->disk->size) {
+        size = runtime->disk->size;
     }
-    memcpy(dest, disk->data, size);
+    memcpy(dest, runtime->disk->data, size);
+    markDirty(runtime, dest, size);
     return size;
 }
 
-int w4_runtimeDiskw (const uint8_t* src, int size) {
-    if (!disk) {
+int w4_runtimeDiskw (w4_Runtime* runtime, const uint8_t* src, int size) {
+    if (!runtime->disk) {
         return 0;
     }
 
     if (size > 1024) {
         size = 1024;
     }
-    disk->size = size;
-    memcpy(disk->data, src, size);
+    // Carts often write the same save every frame
+    if (size == runtime->disk->size && memcmp(runtime->disk->data, src, size) == 0) {
+        return size;
+    }
+    runtime->disk->size = size;
+    memcpy(runtime->disk->data, src, size);
+    ++runtime->diskWrites;
     return size;
 }
 
-void w4_runtimeTrace (const uint8_t* str) {
+int w4_runtimeDiskWrites (w4_Runtime* runtime) {
+    return runtime->diskWrites;
+}
+
+void w4_runtimeTrace (w4_Runtime* runtime, const uint8_t* str) {
     puts(str);
 }
 
-void w4_runtimeTraceUtf8 (const uint8_t* str, int byteLength) {
+void w4_runtimeTraceUtf8 (w4_Runtime* runtime, const uint8_t* str, int byteLength) {
     printf("%.*s\n", byteLength, str);
 }
 
-void w4_runtimeTraceUtf16 (const uint16_t* str, int byteLength) {
+void w4_runtimeTraceUtf16 (w4_Runtime* runtime, const uint16_t* str, int byteLength) {
     printf("TODO: traceUtf16: %p, %d\n", str, byteLength);
 }
 
-void w4_runtimeTracef (const uint8_t* str, const void* stack) {
+void w4_runtimeTracef (w4_Runtime* runtime, const uint8_t* str, const void* stack) {
     puts(str);
 
     // This seems to crash on Linux release builds
@@ -172,40 +297,92 @@ void w4_runtimeTracef (const uint8_t* str, const void* stack) {
     // putchar('\n');
 }
 
-void w4_runtimeUpdate () {
-    if (firstFrame) {
-        firstFrame = false;
-        w4_wasmCallStart();
-    } else if (!(memory->systemFlags & SYSTEM_PRESERVE_FRAMEBUFFER)) {
-        w4_framebufferClear();
+void w4_runtimeUpdate (w4_Runtime* runtime) {
+    uint32_t profileStart;
+    if (runtime->firstFrame) {
+        runtime->firstFrame = false;
+        profileStart = w4_profileBegin();
+        w4_wasmCallStart(runtime->wasm);
+        w4_profileEnd(W4_PROFILE_UPDATE, profileStart);
+    } else if (!(runtime->memory->systemFlags & SYSTEM_PRESERVE_FRAMEBUFFER)) {
+        profileStart = w4_profileBegin();
+        w4_framebufferClear(&runtime->framebuffer);
+        w4_profileEnd(W4_PROFILE_CLEAR, profileStart);
+        markFramebuffer(runtime);
     }
-    w4_wasmCallUpdate();
+    profileStart = w4_profileBegin();
+    w4_wasmCallUpdate(runtime->wasm);
+    w4_profileEnd(W4_PROFILE_UPDATE, profileStart);
+    markWasmStores(runtime);
 }
 
-void w4_runtimeDraw () {
+void w4_runtimeDraw (w4_Runtime* runtime) {
     uint32_t palette[4] = {
-            w4_read32LE(&memory->palette[0]),
-            w4_read32LE(&memory->palette[1]),
-            w4_read32LE(&memory->palette[2]),
-            w4_read32LE(&memory->palette[3]),
+            w4_read32LE(&runtime->memory->palette[0]),
+            w4_read32LE(&runtime->memory->palette[1]),
+            w4_read32LE(&runtime->memory->palette[2]),
+            w4_read32LE(&runtime->memory->palette[3]),
     };
-    w4_windowComposite(palette, memory->framebuffer);
+    if (memcmp(palette, runtime->drawnPalette, sizeof(palette)) != 0) {
+        memcpy(runtime->drawnPalette, palette, sizeof(palette));
+        w4_framebufferMarkDirty(&runtime->framebuffer, 0, HEIGHT);
+    }
+    uint32_t profileStart = w4_profileBegin();
+    if (w4_framebufferTakeDirtyRows(&runtime->framebuffer, runtime->dirtyRows) > 0) {
+        w4_windowComposite(palette, runtime->memory->framebuffer, runtime->dirtyRows);
+    }
+    w4_profileEnd(W4_PROFILE_COMPOSITE, profileStart);
+}
+
+void w4_runtimeInvalidate (w4_Runtime* runtime, int startY, int endY) {
+    w4_framebufferMarkDirty(&runtime->framebuffer, startY, endY);
 }
 
 int w4_runtimeSerializeSize () {
     return sizeof(SerializedState);
 }
 
-void w4_runtimeSerialize (void* dest) {
+static void serializeDisk (const w4_Runtime* runtime, SerializedState* state) {
+    if (runtime->disk) {
+        memcpy(&state->disk, runtime->disk, sizeof(w4_Disk));
+    } else {
+        // Instances without a disk save an empty one
+        memset(&state->disk, 0, sizeof(w4_Disk));
+    }
+}
+
+void w4_runtimeSerialize (w4_Runtime* runtime, void* dest) {
     SerializedState* state = dest;
-    memcpy(&state->memory, memory, 1 << 16);
-    memcpy(&state->disk, disk, sizeof(w4_Disk));
-    state->firstFrame = firstFrame;
+    memcpy(&state->memory, runtime->memory, 1 << 16);
+    serializeDisk(runtime, state);
+    state->firstFrame = runtime->firstFrame;
 }
 
-void w4_runtimeUnserialize (const void* src) {
+int w4_runtimeSerializeDirty (w4_Runtime* runtime, void* dest, uint8_t* pages) {
+    SerializedState* state = dest;
+    const uint8_t* bytes = (const uint8_t*)runtime->memory;
+    uint8_t* copy = (uint8_t*)&state->memory;
+    int count = 0;
+    for (int page = 0; page < W4_PAGE_COUNT; ++page) {
+        if (runtime->dirtyPages[page >> 3] & (1 << (page & 7))) {
+            memcpy(copy + page * W4_PAGE_SIZE, bytes + page * W4_PAGE_SIZE, W4_PAGE_SIZE);
+            ++count;
+        }
+    }
+    memcpy(pages, runtime->dirtyPages, sizeof(runtime->dirtyPages));
+    memset(runtime->dirtyPages, 0, sizeof(runtime->dirtyPages));
+    serializeDisk(runtime, state);
+    state->firstFrame = runtime->firstFrame;
+    return count;
+}
+
+void w4_runtimeUnserialize (w4_Runtime* runtime, const void* src) {
     const SerializedState* state = src;
-    memcpy(memory, &state->memory, 1 << 16);
-    memcpy(disk, &state->disk, sizeof(w4_Disk));
-    firstFrame = state->firstFrame;
+    memcpy(runtime->memory, &state->memory, 1 << 16);
+    if (runtime->disk) {
+        memcpy(runtime->disk, &state->disk, sizeof(w4_Disk));
+        ++runtime->diskWrites;
+    }
+    runtime->firstFrame = state->firstFrame;
+    markAllDirty(runtime);
 }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #define W4_BUTTON_X 1
@@ -15,40 +16,87 @@
 #define W4_MOUSE_RIGHT 2
 #define W4_MOUSE_MIDDLE 4
 
+// Granularity of the dirty page tracking over the 64 KB of wasm memory
+#define W4_PAGE_SIZE 256
+#define W4_PAGE_COUNT 256
+
 typedef struct {
     uint16_t size;
     uint8_t data[1024];
 } w4_Disk;
 
-void w4_runtimeInit (uint8_t* memory, w4_Disk* disk);
+// One emulated console: the cart's wasm instance with its 64 KB of memory, and the framebuffer
+// and bookkeeping around it. Only updates may run on separate threads, one thread per instance,
+// with the instance muted and the profiler off (see host/batch.c). Tones and composited frames go
+// to the single frontend's wasm4_tone_callback() and w4_windowComposite(), and replay, savestate,
+// netplay and the profiler follow one instance at a time, so w4_runtimeDraw() and unmuted
+// instances stay on the frontend's thread.
+typedef struct w4_Runtime w4_Runtime;
+typedef struct w4_Wasm w4_Wasm;
+
+// Creates an instance with a fresh wasm backend, NULL if out of memory. disk is where diskr and
+// diskw go, it may be NULL for carts that don't get to save.
+w4_Runtime* w4_runtimeCreate (w4_Disk* disk);
+void w4_runtimeDestroy (w4_Runtime* runtime);
+
+// The wasm backend of the instance, to load the cart into
+w4_Wasm* w4_runtimeWasm (w4_Runtime* runtime);
+
+void w4_runtimeSetGamepad (w4_Runtime* runtime, int idx, uint8_t gamepad);
+void w4_runtimeSetMouse (w4_Runtime* runtime, int16_t x, int16_t y, uint8_t buttons);
+
+uint8_t w4_runtimeGetGamepad (w4_Runtime* runtime, int idx);
+void w4_runtimeGetMouse (w4_Runtime* runtime, int16_t* x, int16_t* y, uint8_t* buttons);
+const uint8_t* w4_runtimeGetFramebuffer (w4_Runtime* runtime);
 
-void w4_runtimeSetGamepad (int idx, uint8_t gamepad);
-void w4_runtimeSetMouse (int16_t x, int16_t y, uint8_t buttons);
+void w4_runtimeBlit (w4_Runtime* runtime, const uint8_t* sprite, int x, int y, int width, int height, int flags);
+void w4_runtimeBlitSub (w4_Runtime* runtime, const uint8_t* sprite, int x, int y, int width, int height, int srcX, int srcY, int stride, int flags);
+void w4_runtimeLine (w4_Runtime* runtime, int x1, int y1, int x2, int y2);
+void w4_runtimeHLine (w4_Runtime* runtime, int x, int y, int len);
+void w4_runtimeVLine (w4_Runtime* runtime, int x, int y, int len);
+void w4_runtimeOval (w4_Runtime* runtime, int x, int y, int width, int height);
+void w4_runtimeRect (w4_Runtime* runtime, int x, int y, int width, int height);
+void w4_runtimeText (w4_Runtime* runtime, const uint8_t* str, int x, int y);
+void w4_runtimeTextUtf8 (w4_Runtime* runtime, const uint8_t* str, int byteLength, int x, int y);
+void w4_runtimeTextUtf16 (w4_Runtime* runtime, const uint16_t* str, int byteLength, int x, int y);
 
-void w4_runtimeBlit (const uint8_t* sprite, int x, int y, int width, int height, int flags);
-void w4_runtimeBlitSub (const uint8_t* sprite, int x, int y, int width, int height, int srcX, int srcY, int stride, int flags);
-void w4_runtimeLine (int x1, int y1, int x2, int y2);
-void w4_runtimeHLine (int x, int y, int len);
-void w4_runtimeVLine (int x, int y, int len);
-void w4_runtimeOval (int x, int y, int width, int height);
-void w4_runtimeRect (int x, int y, int width, int height);
-void w4_runtimeText (const uint8_t* str, int x, int y);
-void w4_runtimeTextUtf8 (const uint8_t* str, int byteLength, int x, int y);
-void w4_runtimeTextUtf16 (const uint16_t* str, int byteLength, int x, int y);
+void w4_runtimeTone (w4_Runtime* runtime, int frequency, int duration, int volume, int flags);
 
-void w4_runtimeTone (int frequency, int duration, int volume, int flags);
+// Drops the cart's tones while set, for frames that are simulated again or never shown
+void w4_runtimeSetMuted (w4_Runtime* runtime, bool muted);
+bool w4_runtimeMuted (w4_Runtime* runtime);
 
-int w4_runtimeDiskr (uint8_t* dest, int size);
-int w4_runtimeDiskw (const uint8_t* src, int size);
+int w4_runtimeDiskr (w4_Runtime* runtime, uint8_t* dest, int size);
+int w4_runtimeDiskw (w4_Runtime* runtime, const uint8_t* src, int size);
 
-void w4_runtimeTrace (const uint8_t* str);
-void w4_runtimeTraceUtf8 (const uint8_t* str, int byteLength);
-void w4_runtimeTraceUtf16 (const uint16_t* str, int byteLength);
-void w4_runtimeTracef (const uint8_t* str, const void* stack);
+// Counts the times the disk contents changed, by diskw or by restoring a state. Frontends compare
+// it against the count they last saw to know when the disk needs saving.
+int w4_runtimeDiskWrites (w4_Runtime* runtime);
 
-void w4_runtimeUpdate ();
-void w4_runtimeDraw ();
+void w4_runtimeTrace (w4_Runtime* runtime, const uint8_t* str);
+void w4_runtimeTraceUtf8 (w4_Runtime* runtime, const uint8_t* str, int byteLength);
+void w4_runtimeTraceUtf16 (w4_Runtime* runtime, const uint16_t* str, int byteLength);
+void w4_runtimeTracef (w4_Runtime* runtime, const uint8_t* str, const void* stack);
 
+void w4_runtimeUpdate (w4_Runtime* runtime);
+
+// Composites the framebuffer rows that changed since the last draw
+void w4_runtimeDraw (w4_Runtime* runtime);
+
+// Recomposites framebuffer rows [startY, endY) on the next draw, for frontends that drew over them
+void w4_runtimeInvalidate (w4_Runtime* runtime, int startY, int endY);
+
+// A serialized state starts with the W4_PAGE_COUNT pages of wasm memory, followed by the disk and
+// the rest of the runtime state
 int w4_runtimeSerializeSize ();
-void w4_runtimeSerialize (void* dest);
-void w4_runtimeUnserialize (const void* src);
+void w4_runtimeSerialize (w4_Runtime* runtime, void* dest);
+void w4_runtimeUnserialize (w4_Runtime* runtime, const void* src);
+
+// Like w4_runtimeSerialize(), but only copies the memory pages written since the last call. dest
+// has to hold the state it serialized last time, or a full serialize taken after that. Sets a bit
+// in pages (W4_PAGE_COUNT / 8 bytes) for each page copied and returns how many there are.
+//
+// Writes by the runtime and the frontend are tracked exactly. Stores by the cart itself are only
+// tracked when built with W4_TRACK_WASM_STORES, which compares memory against a copy after every
+// update, otherwise every page counts as written once the cart ran.
+int w4_runtimeSerializeDirty (w4_Runtime* runtime, void* dest, uint8_t* pages);
@@ -0,0 +1,366 @@
+#include "savestate.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "runtime.h"
+
+#define MAX_STATES 256
+
+// Deltas are taken against the same keyframe until this many were captured, or one of them grows
+// past a quarter of a whole state
+#define KEYFRAME_INTERVAL 64
+
+// Unchanged stretches shorter than this are cheaper to keep inside a literal run
+#define MIN_SKIP 4
+
+typedef struct {
+    uint32_t offset;
+    uint32_t size;
+    uint32_t id;
+    // Id of the keyframe this is a delta against, equal to id for keyframes
+    uint32_t keyId;
+} Entry;
+
+static uint8_t* ring;
+static int capacity;
+static int stateSize;
+
+// Uncompressed state of the keyframe with id keyframeId, and the last captured state
+static uint8_t* keyframe;
+static uint8_t* scratch;
+static uint32_t keyframeId;
+static bool keyframeValid;
+static int deltasSinceKeyframe;
+
+// Memory pages that may differ between scratch and keyframe, only these have to be compared. Only
+// valid while scratchValid, otherwise scratch doesn't hold the last captured state.
+static uint8_t changedPages[W4_PAGE_COUNT >> 3];
+static bool scratchValid;
+
+// Entries in capture order, their data laid out one after another in the ring and wrapping back
+// to the start when the next one doesn't fit
+static Entry entries[MAX_STATES];
+static int first;
+static int count;
+static int used;
+static uint32_t writeOffset;
+static uint32_t nextId;
+
+static uint8_t* putVarint (uint8_t* dst, uint32_t value) {
+    while (value >= 0x80) {
+        *dst++ = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    *dst++ = value;
+    return dst;
+}
+
+static const uint8_t* getVarint (const uint8_t* src, uint32_t* value) {
+    *value = 0;
+    for (int shift = 0; ; shift += 7) {
+        uint8_t byte = *src++;
+        *value |= (uint32_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return src;
+        }
+    }
+}
+
+static uint8_t baseAt (const uint8_t* base, int pos) {
+    return base != NULL ? base[pos] : 0;
+}
+
+static bool pageChanged (const uint8_t* pages, int pos) {
+    int page = pos / W4_PAGE_SIZE;
+    return page >= W4_PAGE_COUNT || (pages[page >> 3] & (1 << (page & 7)));
+}
+
+// Skips bytes where state matches base (all zero when base is NULL), a word at a time. Pages not
+// set in pages are known to match and skipped whole.
+static int skipUnchanged (const uint8_t* state, const uint8_t* base, const uint8_t* pages, int pos) {
+    while (pos < stateSize) {
+        int end = pos / W4_PAGE_SIZE < W4_PAGE_COUNT ? (pos / W4_PAGE_SIZE + 1) * W4_PAGE_SIZE : stateSize;
+        if (!pageChanged(pages, pos)) {
+            pos = end;
+            continue;
+        }
+        for (; pos + 4 <= end; pos += 4) {
+            uint32_t a, b = 0;
+            memcpy(&a, state + pos, 4);
+            if (base != NULL) {
+                memcpy(&b, base + pos, 4);
+            }
+            if (a != b) {
+                break;
+            }
+        }
+        while (pos < end && state[pos] == baseAt(base, pos)) {
+            ++pos;
+        }
+        if (pos < end) {
+            break;
+        }
+    }
+    return pos;
+}
+
+// Encodes state as runs of (unchanged count, changed count, changed bytes XOR base). Returns the
+// encoded size, or -1 if it would be larger than maxSize.
+static int encode (uint8_t* dst, int maxSize, const uint8_t* state, const uint8_t* base,
+    const uint8_t* pages) {
+    uint8_t* out = dst;
+    int last = 0;
+    for (int pos = 0;;) {
+        pos = skipUnchanged(state, base, pages, pos);
+        if (pos >= stateSize) {
+            break;
+        }
+
+        // The literal run ends at the first stretch of MIN_SKIP unchanged bytes
+        int start = pos;
+        int end = pos + 1;
+        for (int same = 0, n = end; n < stateSize && same < MIN_SKIP; ++n) {
+            if (state[n] != baseAt(base, n)) {
+                end = n + 1;
+                same = 0;
+            } else {
+                ++same;
+            }
+        }
+
+        int length = end - start;
+        if (maxSize - (out - dst) < 10 + length) {
+            return -1;
+        }
+        out = putVarint(out, start - last);
+        out = putVarint(out, length);
+        for (int n = start; n < end; ++n) {
+            *out++ = state[n] ^ baseAt(base, n);
+        }
+        last = pos = end;
+    }
+    return out - dst;
+}
+
+static void decode (uint8_t* state, const uint8_t* src, int size) {
+    const uint8_t* end = src + size;
+    uint8_t* dst = state;
+    while (src < end) {
+        uint32_t skip, length;
+        src = getVarint(src, &skip);
+        src = getVarint(src, &length);
+        dst += skip;
+        for (uint32_t n = 0; n < length; ++n) {
+            *dst++ ^= *src++;
+        }
+    }
+}
+
+static Entry* oldest () {
+    return &entries[first];
+}
+
+static Entry* newest () {
+    return &entries[(first + count - 1) % MAX_STATES];
+}
+
+static void dropped (const Entry* entry) {
+    used -= entry->size;
+    if (entry->id == keyframeId) {
+        keyframeValid = false;
+    }
+}
+
+static void dropOldest () {
+    dropped(oldest());
+    first = (first + 1) % MAX_STATES;
+    --count;
+
+    // Deltas can't be restored without their keyframe
+    while (count > 0 && oldest()->keyId != oldest()->id) {
+        dropped(oldest());
+        first = (first + 1) % MAX_STATES;
+        --count;
+    }
+}
+
+static void dropNewest () {
+    dropped(newest());
+    --count;
+    writeOffset = count > 0 ? newest()->offset + newest()->size : 0;
+}
+
+// Drops the states whose data overlaps [start, end). Data past writeOffset always belongs to the
+// oldest states, in order.
+static void evict (uint32_t start, uint32_t end) {
+    while (count > 0 && oldest()->offset < end && oldest()->offset + oldest()->size > start) {
+        dropOldest();
+    }
+}
+
+static bool allocate () {
+    if (ring != NULL) {
+        return true;
+    }
+    if (capacity <= 0) {
+        return false;
+    }
+    stateSize = w4_runtimeSerializeSize();
+    ring = malloc(capacity);
+    keyframe = malloc(stateSize);
+    scratch = malloc(stateSize);
+    if (ring == NULL || keyframe == NULL || scratch == NULL) {
+        w4_savestateFree();
+        return false;
+    }
+    return true;
+}
+
+// Stores scratch as a keyframe, or as a delta against the current keyframe
+static bool store (bool isKeyframe) {
+    static const uint8_t allPages[W4_PAGE_COUNT >> 3] = {
+        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    };
+    const uint8_t* base = isKeyframe ? NULL : keyframe;
+    const uint8_t* pages = isKeyframe ? allPages : changedPages;
+    int limit = isKeyframe ? capacity : stateSize / 4;
+    if (limit > capacity) {
+        limit = capacity;
+    }
+
+    // A failed attempt still overwrote the ring up to its limit, the states there are lost
+    int room = capacity - writeOffset;
+    int size;
+    if (room < limit) {
+        size = encode(ring + writeOffset, room, scratch, base, pages);
+        if (size < 0) {
+            // Doesn't fit before the end of the ring, wrap around
+            evict(writeOffset, capacity);
+            writeOffset = 0;
+            size = encode(ring, limit, scratch, base, pages);
+        }
+    } else {
+        size = encode(ring + writeOffset, limit, scratch, base, pages);
+    }
+    if (size < 0) {
+        evict(writeOffset, writeOffset + limit);
+        return false;
+    }
+    evict(writeOffset, writeOffset + size);
+    if (count == MAX_STATES) {
+        dropOldest();
+    }
+    if (!isKeyframe && !keyframeValid) {
+        // The keyframe itself had to make room for this delta
+        return false;
+    }
+
+    Entry* entry = &entries[(first + count) % MAX_STATES];
+    entry->offset = writeOffset;
+    entry->size = size;
+    entry->id = nextId++;
+    entry->keyId = isKeyframe ? entry->id : keyframeId;
+    ++count;
+    used += size;
+    writeOffset += size;
+
+    if (isKeyframe) {
+        memcpy(keyframe, scratch, stateSize);
+        keyframeId = entry->id;
+        keyframeValid = true;
+        deltasSinceKeyframe = 0;
+        memset(changedPages, 0, sizeof(changedPages));
+    } else {
+        ++deltasSinceKeyframe;
+    }
+    return true;
+}
+
+void w4_savestateInit (int capacity_) {
+    w4_savestateFree();
+    capacity = capacity_;
+}
+
+void w4_savestateFree () {
+    free(ring);
+    free(keyframe);
+    free(scratch);
+    ring = NULL;
+    keyframe = NULL;
+    scratch = NULL;
+    w4_savestateReset();
+}
+
+void w4_savestateReset () {
+    first = 0;
+    count = 0;
+    used = 0;
+    writeOffset = 0;
+    keyframeValid = false;
+    scratchValid = false;
+}
+
+bool w4_savestateCapture (w4_Runtime* runtime) {
+    if (!allocate()) {
+        return false;
+    }
+    if (scratchValid) {
+        // Only the pages written since the last capture need copying and comparing
+        uint8_t pages[W4_PAGE_COUNT >> 3];
+        w4_runtimeSerializeDirty(runtime, scratch, pages);
+        for (int n = 0; n < (int)sizeof(pages); ++n) {
+            changedPages[n] |= pages[n];
+        }
+    } else {
+        w4_runtimeSerialize(runtime, scratch);
+        memset(changedPages, 0xff, sizeof(changedPages));
+        scratchValid = true;
+    }
+
+    if (keyframeValid && deltasSinceKeyframe < KEYFRAME_INTERVAL && store(false)) {
+        return true;
+    }
+    return store(true);
+}
+
+bool w4_savestateRewind (w4_Runtime* runtime) {
+    if (count == 0) {
+        return false;
+    }
+
+    Entry* entry = newest();
+    if (entry->keyId == entry->id) {
+        memset(scratch, 0, stateSize);
+    } else {
+        if (!keyframeValid || keyframeId != entry->keyId) {
+            // Stepped back past the keyframe the buffer holds, unpack the older one
+            int n = count - 1;
+            while (n >= 0 && entries[(first + n) % MAX_STATES].id != entry->keyId) {
+                --n;
+            }
+            const Entry* key = &entries[(first + n) % MAX_STATES];
+            memset(keyframe, 0, stateSize);
+            decode(keyframe, ring + key->offset, key->size);
+            keyframeId = key->id;
+            keyframeValid = true;
+        }
+        memcpy(scratch, keyframe, stateSize);
+    }
+    decode(scratch, ring + entry->offset, entry->size);
+    w4_runtimeUnserialize(runtime, scratch);
+    // scratch is the current state again, but may differ from the keyframe anywhere
+    memset(changedPages, 0xff, sizeof(changedPages));
+
+    dropNewest();
+    return true;
+}
+
+int w4_savestateCount () {
+    return count;
+}
+
+int w4_savestateBytes () {
+    return used;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "runtime.h"
+
+// Savestates for rewind. States go into a fixed size ring, each one stored as an XOR delta against
+// the last keyframe with the unchanged stretches run length encoded away, so a capture usually
+// costs a few hundred bytes. Keyframes are kept compressed the same way.
+
+// Sets the number of bytes the ring may hold and drops every state. Nothing is allocated until the
+// first capture, on top of the ring that takes two uncompressed states of scratch space.
+void w4_savestateInit (int capacity);
+
+// Frees the ring and its scratch space, w4_savestateInit() has to be called again to use it
+void w4_savestateFree ();
+
+// Drops every state, for when a different cart is loaded
+void w4_savestateReset ();
+
+// Captures the current state of runtime, returns false if it couldn't be stored
+bool w4_savestateCapture (w4_Runtime* runtime);
+
+// Restores the newest state and removes it from the ring, so repeated calls step further back.
+// Returns false when there is nothing left to rewind to.
+bool w4_savestateRewind (w4_Runtime* runtime);
+
+// Number of states and bytes in the ring
+int w4_savestateCount ();
+int w4_savestateBytes ();
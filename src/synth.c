@@ -0,0 +1,338 @@
+#include "synth.h"
+
+#include <string.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Loudest sample of one channel, leaving headroom for the four of them to be mixed
+#define MAX_VOLUME 0x1333
+#define MAX_VOLUME_TRIANGLE 0x2000
+
+// The noise channel's LFSR can be clocked many times per sample at high frequencies, past this
+// many the output is white noise anyway
+#define MAX_NOISE_CLOCKS 16
+
+// Tones waiting for their channel to reach their start, per channel. A power of two.
+#define QUEUE_SIZE 32
+
+typedef enum {
+    SEGMENT_ATTACK,
+    SEGMENT_DECAY,
+    SEGMENT_SUSTAIN,
+    SEGMENT_RELEASE,
+    SEGMENT_OFF,
+} Segment;
+
+typedef struct {
+    // Frequency in Hz as 16.16, moved by freqStep every sample while the tone slides
+    uint32_t freq;
+    int32_t freqStep;
+    // Position in the waveform, a full period is 2^32
+    uint32_t phase;
+    uint32_t phaseStep;
+    // The pulse is high while phase is below this
+    uint32_t dutyCycle;
+
+    // Envelope level as 16.16 sample amplitude, moved by envelopeStep until the segment ends
+    Segment segment;
+    int remaining;
+    int32_t envelope;
+    int32_t envelopeStep;
+    int lengths[SEGMENT_OFF];
+    int32_t peakVolume;
+    int32_t sustainVolume;
+
+    // LFSR clocks per sample as 16.16, and the frequency they were worked out for
+    uint32_t noisePhase;
+    uint32_t noiseStep;
+    uint32_t noiseFreq;
+    uint16_t noiseSeed;
+    int16_t noiseLevel;
+} Channel;
+
+// Counters shared with the audio callback. MSVC's C compiler has no <stdatomic.h>, it gets the
+// interlocked intrinsics instead of the GCC/Clang builtins.
+#if defined(_MSC_VER)
+typedef volatile long Counter;
+
+static uint32_t loadRelaxed (Counter* counter) {
+    return (uint32_t)*counter;
+}
+
+static uint32_t loadAcquire (Counter* counter) {
+    return (uint32_t)_InterlockedOr(counter, 0);
+}
+
+static void storeRelaxed (Counter* counter, uint32_t value) {
+    *counter = (long)value;
+}
+
+static void storeRelease (Counter* counter, uint32_t value) {
+    _InterlockedExchange(counter, (long)value);
+}
+#else
+typedef volatile uint32_t Counter;
+
+static uint32_t loadRelaxed (Counter* counter) {
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+static uint32_t loadAcquire (Counter* counter) {
+    return __atomic_load_n(counter, __ATOMIC_ACQUIRE);
+}
+
+static void storeRelaxed (Counter* counter, uint32_t value) {
+    __atomic_store_n(counter, value, __ATOMIC_RELAXED);
+}
+
+static void storeRelease (Counter* counter, uint32_t value) {
+    __atomic_store_n(counter, value, __ATOMIC_RELEASE);
+}
+#endif
+
+typedef struct {
+    // Sample the tone starts at, on the channel's clock
+    uint32_t time;
+    int frequency;
+    int duration;
+    int volume;
+    int flags;
+} ToneEvent;
+
+// Single producer, single consumer ring. w4_synthTone() only writes head, the channel's render
+// only writes tail and clock.
+typedef struct {
+    ToneEvent events[QUEUE_SIZE];
+    Counter head;
+    Counter tail;
+    // Samples rendered so far
+    Counter clock;
+} Queue;
+
+// Channels are only touched by w4_synthRender(), tones reach them through the queues
+static Channel channels[W4_SYNTH_CHANNELS];
+static Queue queues[W4_SYNTH_CHANNELS];
+static int sampleRate;
+// Phase step of a 1 Hz tone
+static uint32_t phasePerHz;
+
+// Producer side: the sample the current frame started at, and the part of a sample the frames
+// added up to so far in 1/60ths. Tones are stamped a frame later than that, so the audio callback
+// still finds them queued when their time comes even though it runs on its own schedule.
+static uint32_t frameTime;
+static uint32_t frameRemainder;
+
+void w4_synthInit (int sampleRate_) {
+    sampleRate = sampleRate_;
+    phasePerHz = (uint32_t)((1ull << 32) / sampleRate);
+    memset(channels, 0, sizeof(channels));
+    for (int n = 0; n < W4_SYNTH_CHANNELS; ++n) {
+        channels[n].segment = SEGMENT_OFF;
+        channels[n].noiseSeed = 0x0001;
+        storeRelaxed(&queues[n].head, 0);
+        storeRelaxed(&queues[n].tail, 0);
+        storeRelaxed(&queues[n].clock, 0);
+    }
+    frameTime = 0;
+    frameRemainder = 0;
+}
+
+static int32_t segmentTarget (const Channel* channel, Segment segment) {
+    switch (segment) {
+        case SEGMENT_ATTACK: return channel->peakVolume;
+        case SEGMENT_DECAY:
+        case SEGMENT_SUSTAIN: return channel->sustainVolume;
+        default: return 0;
+    }
+}
+
+// Enters segment, or the first one after it that isn't empty
+static void startSegment (Channel* channel, Segment segment) {
+    for (; segment < SEGMENT_OFF; ++segment) {
+        int32_t target = segmentTarget(channel, segment) << 16;
+        int length = channel->lengths[segment];
+        if (length > 0) {
+            channel->envelopeStep = (target - channel->envelope) / length;
+            channel->remaining = length;
+            break;
+        }
+        channel->envelope = target;
+    }
+    channel->segment = segment;
+}
+
+static int framesToSamples (int frames) {
+    return frames * sampleRate / 60;
+}
+
+static void startTone (Channel* channel, int channelIdx, const ToneEvent* event) {
+    int frequency = event->frequency;
+    int duration = event->duration;
+    int volume = event->volume;
+    int flags = event->flags;
+
+    int freq1 = frequency & 0xffff;
+    int freq2 = (frequency >> 16) & 0xffff;
+
+    int sustain = duration & 0xff;
+    int release = (duration >> 8) & 0xff;
+    int decay = (duration >> 16) & 0xff;
+    int attack = (duration >> 24) & 0xff;
+
+    int sustainVolume = volume & 0xff;
+    int peakVolume = (volume >> 8) & 0xff;
+    sustainVolume = sustainVolume < 100 ? sustainVolume : 100;
+    peakVolume = peakVolume < 100 ? peakVolume : 100;
+
+    int mode = (flags >> 2) & 0x3;
+    // Pan (flags >> 4) is dropped, the output is mono
+
+    int maxVolume = channelIdx == 2 ? MAX_VOLUME_TRIANGLE : MAX_VOLUME;
+    channel->peakVolume = peakVolume ? maxVolume * peakVolume / 100 : maxVolume;
+    channel->sustainVolume = maxVolume * sustainVolume / 100;
+    channel->lengths[SEGMENT_ATTACK] = framesToSamples(attack);
+    channel->lengths[SEGMENT_DECAY] = framesToSamples(decay);
+    channel->lengths[SEGMENT_SUSTAIN] = framesToSamples(sustain);
+    channel->lengths[SEGMENT_RELEASE] = framesToSamples(release);
+
+    static const uint32_t dutyCycles[] = {0x20000000, 0x40000000, 0x80000000, 0xc0000000};
+    channel->dutyCycle = dutyCycles[mode];
+
+    // The slide from freq1 to freq2 lasts the whole tone
+    int total = framesToSamples(attack + decay + sustain + release);
+    channel->freq = (uint32_t)freq1 << 16;
+    channel->freqStep = freq2 != 0 && total > 0
+        ? (int32_t)(((int64_t)(freq2 - freq1) << 16) / total) : 0;
+    channel->phaseStep = (uint32_t)(((uint64_t)channel->freq * phasePerHz) >> 16);
+    channel->noiseFreq = UINT32_MAX;
+
+    channel->envelope = 0;
+    startSegment(channel, SEGMENT_ATTACK);
+}
+
+// Moves the frame clock back in line with the audio clock when it drifted behind it, or too far
+// ahead of it (frames run faster than real time, or audio was paused)
+static void syncFrameTime () {
+    uint32_t now = loadRelaxed(&queues[0].clock);
+    int32_t ahead = (int32_t)(frameTime - now);
+    if (ahead < 0 || ahead > sampleRate / 15) {
+        frameTime = now;
+        frameRemainder = 0;
+    }
+}
+
+void w4_synthTone (int frequency, int duration, int volume, int flags) {
+    Queue* queue = &queues[flags & 0x03];
+    unsigned head = loadRelaxed(&queue->head);
+    unsigned tail = loadAcquire(&queue->tail);
+    if (head - tail == QUEUE_SIZE) {
+        // The callback stopped pulling samples, drop the tone rather than wait for it
+        return;
+    }
+
+    syncFrameTime();
+    ToneEvent* event = &queue->events[head & (QUEUE_SIZE - 1)];
+    event->time = frameTime + sampleRate / 60;
+    event->frequency = frequency;
+    event->duration = duration;
+    event->volume = volume;
+    event->flags = flags;
+    storeRelease(&queue->head, head + 1);
+}
+
+void w4_synthEndFrame () {
+    frameRemainder += sampleRate;
+    frameTime += frameRemainder / 60;
+    frameRemainder %= 60;
+    syncFrameTime();
+}
+
+static uint32_t noiseStep (Channel* channel) {
+    // Clocked at freq^2 / (1000000 / 44100) Hz like the reference APU
+    uint32_t hz = channel->freq >> 16;
+    if (hz != channel->noiseFreq) {
+        channel->noiseFreq = hz;
+        channel->noiseStep = (uint32_t)((uint64_t)hz * hz * 44100 / 1000000 * 65536 / sampleRate);
+    }
+    return channel->noiseStep;
+}
+
+// Current sample of the channel's waveform, between -32767 and 32767
+static int32_t waveform (Channel* channel, int channelIdx) {
+    if (channelIdx < 2) {
+        return channel->phase < channel->dutyCycle ? 32767 : -32767;
+    }
+    if (channelIdx == 2) {
+        uint32_t position = channel->phase >> 16;
+        uint32_t rising = position < 0x8000 ? position : 0xffff - position;
+        return (int32_t)rising * 2 - 32767;
+    }
+
+    channel->noisePhase += noiseStep(channel);
+    uint32_t clocks = channel->noisePhase >> 16;
+    channel->noisePhase &= 0xffff;
+    if (clocks > MAX_NOISE_CLOCKS) {
+        clocks = MAX_NOISE_CLOCKS;
+    }
+    for (; clocks > 0; --clocks) {
+        uint16_t seed = channel->noiseSeed;
+        seed ^= seed >> 7;
+        seed ^= seed << 9;
+        seed ^= seed >> 13;
+        channel->noiseSeed = seed;
+        channel->noiseLevel = (seed & 0x1) ? 32767 : -32767;
+    }
+    return channel->noiseLevel;
+}
+
+static void renderSamples (Channel* channel, int channelIdx, int16_t* out, int count) {
+    for (int n = 0; n < count; ++n) {
+        if (channel->segment == SEGMENT_OFF) {
+            memset(out + n, 0, (count - n) * sizeof(int16_t));
+            return;
+        }
+
+        out[n] = waveform(channel, channelIdx) * (channel->envelope >> 16) >> 15;
+
+        channel->phase += channel->phaseStep;
+        if (channel->freqStep != 0) {
+            channel->freq += channel->freqStep;
+            channel->phaseStep = (uint32_t)(((uint64_t)channel->freq * phasePerHz) >> 16);
+        }
+        channel->envelope += channel->envelopeStep;
+        if (--channel->remaining == 0) {
+            // Land exactly on the target, the steps were rounded
+            channel->envelope = segmentTarget(channel, channel->segment) << 16;
+            startSegment(channel, channel->segment + 1);
+        }
+    }
+}
+
+void w4_synthRender (int channelIdx, int16_t* out, int count) {
+    Channel* channel = &channels[channelIdx];
+    Queue* queue = &queues[channelIdx];
+    uint32_t clock = loadRelaxed(&queue->clock);
+    unsigned tail = loadRelaxed(&queue->tail);
+
+    for (int n = 0; n < count;) {
+        // Start the tones that are due, and render up to the next one
+        int run = count - n;
+        unsigned head = loadAcquire(&queue->head);
+        for (; tail != head; ++tail) {
+            const ToneEvent* event = &queue->events[tail & (QUEUE_SIZE - 1)];
+            int32_t offset = (int32_t)(event->time - (clock + n));
+            if (offset > 0) {
+                run = offset < run ? offset : run;
+                break;
+            }
+            startTone(channel, channelIdx, event);
+        }
+        storeRelease(&queue->tail, tail);
+
+        renderSamples(channel, channelIdx, out + n, run);
+        n += run;
+    }
+    storeRelaxed(&queue->clock, clock + count);
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+
+// Renders the four WASM-4 sound channels: two pulse waves, a triangle and noise. Everything runs in
+// fixed point on the sample clock, so tones last exactly as long as the cart asked for whatever the
+// frame rate is.
+//
+// w4_synthTone() and w4_synthEndFrame() belong to the thread running the cart, w4_synthRender() to
+// the audio callback. Tones pass between them through lock-free queues, stamped with the sample
+// their frame maps to, so neither side ever waits for the other.
+
+#define W4_SYNTH_CHANNELS 4
+
+void w4_synthInit (int sampleRate);
+
+// Queues a tone, with the arguments of the WASM-4 tone() function. Durations are in 60 Hz frames.
+// Tones of the same frame start together, a later one on the same channel replaces the earlier.
+void w4_synthTone (int frequency, int duration, int volume, int flags);
+
+// Call after each cart update, moves the time new tones are stamped with a frame ahead
+void w4_synthEndFrame ();
+
+// Renders the next count mono samples of one channel
+void w4_synthRender (int channel, int16_t* out, int count);
@@ -1,11 +1,63 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 
-uint8_t* w4_wasmInit ();
-void w4_wasmDestroy ();
+// The functions a cart can import, in the order of w4_wasmImportName()
+typedef enum {
+    W4_IMPORT_BLIT,
+    W4_IMPORT_BLIT_SUB,
+    W4_IMPORT_LINE,
+    W4_IMPORT_HLINE,
+    W4_IMPORT_VLINE,
+    W4_IMPORT_OVAL,
+    W4_IMPORT_RECT,
+    W4_IMPORT_TEXT,
+    W4_IMPORT_TEXT_UTF8,
+    W4_IMPORT_TEXT_UTF16,
+    W4_IMPORT_TONE,
+    W4_IMPORT_DISKR,
+    W4_IMPORT_DISKW,
+    W4_IMPORT_TRACE,
+    W4_IMPORT_TRACE_UTF8,
+    W4_IMPORT_TRACE_UTF16,
+    W4_IMPORT_TRACEF,
+    W4_IMPORT_COUNT,
+} w4_WasmImport;
 
-void w4_wasmLoadModule (const uint8_t* wasmBuffer, int byteLength);
+// Called after each function compiled by w4_wasmCompileModule()
+typedef void (*w4_WasmCompileProgress) (int compiled, int total);
 
-void w4_wasmCallStart ();
-void w4_wasmCallUpdate ();
+typedef struct w4_Wasm w4_Wasm;
+typedef struct w4_Runtime w4_Runtime;
+typedef struct w4_Framebuffer w4_Framebuffer;
+
+// Creates the wasm instance of runtime, with its imports drawing into framebuffer. Returns NULL if
+// out of memory. w4_runtimeCreate() calls this, frontends don't need to.
+w4_Wasm* w4_wasmInit (w4_Runtime* runtime, w4_Framebuffer* framebuffer);
+void w4_wasmDestroy (w4_Wasm* wasm);
+
+// The instance's 64 KB of linear memory
+uint8_t* w4_wasmMemory (w4_Wasm* wasm);
+
+// Returns false if the module couldn't be loaded, see w4_wasmError()
+bool w4_wasmLoadModule (w4_Wasm* wasm, const uint8_t* wasmBuffer, int byteLength);
+
+// Compiles up to budget functions of the loaded module ahead of time (every remaining one when
+// budget <= 0), instead of leaving it to their first call. Returns true once the whole module is
+// compiled or compiling failed (see w4_wasmError()), call it again to continue where the last
+// call stopped.
+bool w4_wasmCompileModule (w4_Wasm* wasm, int budget, w4_WasmCompileProgress progress);
+
+void w4_wasmCallStart (w4_Wasm* wasm);
+void w4_wasmCallUpdate (w4_Wasm* wasm);
+
+// Why the cart stopped, or NULL while it runs. Once it trapped or failed to load or compile, calls
+// into it do nothing.
+const char* w4_wasmError (const w4_Wasm* wasm);
+
+const char* w4_wasmImportName (w4_WasmImport import);
+
+// Calls the cart made to an import since it was loaded or the counters were last reset
+uint32_t w4_wasmImportCalls (const w4_Wasm* wasm, w4_WasmImport import);
+void w4_wasmResetImportCalls (w4_Wasm* wasm);
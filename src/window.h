@@ -4,4 +4,5 @@
 
 void w4_windowBoot (const char* title);
 
-void w4_windowComposite (const uint32_t* palette, const uint8_t* framebuffer);
+// dirtyRows has one entry per framebuffer row, only rows where it is non-zero need converting
+void w4_windowComposite (const uint32_t* palette, const uint8_t* framebuffer, const uint8_t* dirtyRows);